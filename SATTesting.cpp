@@ -3,7 +3,22 @@
 #include "TL-Engine11.h" // TL-Engine11 include file and namespace
 
 #include <vector>
+#include <string>
+#include <algorithm> // For sorting points in convex hull
+#include <functional> // For hashing outlines in the convex decomposition cache
 #include <iostream> // For debug to console
+#include <atomic> // For counting allocations
+#include <new> // For replacing the global operator new and delete, to count allocations
+#include <cstdlib>
+#include <chrono> // For timing the headless world
+#include <random> // For placing shapes in the headless world
+#include <thread> // For running batched queries in parallel
+#include <mutex>
+#include <condition_variable>
+#include <xmmintrin.h> // SSE, for testing 4 bounding boxes at once in queries
+#include <array> // For the shape pair dispatch tables
+#include <utility> // For std::integer_sequence
+#include <type_traits> // For checking a shape pair has a test at compile time
 
 using namespace tle;
 
@@ -15,6 +30,43 @@ const float ShapeHiddenHeight = -15.0f;
 const float ShapeVisibleHeight = 0.0f;
 const float MoveSpeed = 10.0f;
 const float RotateSpeed = 60.0f;
+const float CapsuleTouchingTolerance = 0.001f; // Fraction of the radius below which closest points count as the same point
+const int PairCacheMinBuckets = 64;
+const float SweepParallelTolerance = 0.000001f; // Speeds along an axis below this count as moving along its side
+const int QueryLanes = 4; // Bounding boxes per SSE test
+const int QueryChunkSize = 64; // Queries each worker takes at a time
+const float QueryWideBodyFactor = 8.0f; // Bodies this many times wider than average are checked by every query
+const int PolygonCoarseHullMaxSides = 8; // Polygons with more sides than this have a coarse hull with at most this many sides
+
+// Headless world constants
+const float HeadlessHalfArea = 400.0f;
+const int HeadlessNumDynamicBodies = 2000;
+const int HeadlessPairsPerBody = 8; // Pair cache space reserved per body
+const int HeadlessNumWarmUpSteps = 120;
+const int HeadlessNumTimedSteps = 600;
+const float HeadlessDeltaTime = 1.0f / 60.0f;
+const int HeadlessNumRays = 4096;
+const int HeadlessNumShapeCasts = 1024;
+const float HeadlessQueryDistance = 100.0f;
+const int HeadlessNumQueryRepeats = 20;
+const double HeadlessRayTargetTime = 5.0; // ms for the batch of raycasts, slower fails the run
+const double HeadlessShapeCastTargetTime = 3.0; // ms for the batch of shape casts, slower fails the run
+const float QueryCheckTolerance = 0.001f; // Difference in hit distance and normal allowed between the batched queries and checking every body
+const int HeadlessNumPolygonChecks = 100000; // Random polygon pairs checked against the exact SAT
+
+// Crowd constants
+const int CrowdNumAgents = 100000;
+const float CrowdHalfArea = 1000.0f;
+const float CrowdMinAgentRadius = 0.8f;
+const float CrowdMaxAgentRadius = 1.5f;
+const float CrowdCellSize = 4.0f; // At least the widest agent. Bigger cells mean fewer cells to sort agents into, but more neighbours to check.
+const float CrowdSteerRate = 4.0f; // Fraction of the way per second an agent's velocity turns towards its goal
+const float CrowdGoalRadius = 2.0f; // Agents pick a new goal when this close to their goal
+const int CrowdChunkSize = 256; // Agents each worker takes at a time
+const int CrowdRowsPerChunk = 2; // Rows of the grid each worker takes at a time when colliding agents
+const int CrowdNumWarmUpSteps = 60;
+const int CrowdNumTimedSteps = 100;
+const float CrowdDeltaTime = 1.0f / 60.0f;
 
 // Game states
 enum EShapeControl { eCircle, eTriangle, eSquare, ePentagon, eNumShapeControl };
@@ -40,41 +92,73 @@ struct Vector2
 	Vector2 Subtract(const Vector2& OtherVec) const;
 	Vector2 Add(const Vector2& OtherVec) const;
 	float DotProduct(const Vector2& OtherVec) const;
+	float CrossProduct(const Vector2& OtherVec) const;
 	Vector2 PerpendicularVector() const;
+	Vector2 Rotate(const float& Cos, const float& Sin) const;
 };
 
-// Base struct for shapes
+// Axis aligned box used for bounding volumes
+struct BoundingBox
+{
+	Vector2 mMin;
+	Vector2 mMax;
+
+	bool Overlaps(const BoundingBox& OtherBox) const;
+	BoundingBox Merge(const BoundingBox& OtherBox) const;
+	Vector2 GetCentre() const;
+};
+
+// Base struct for shapes.
+// Shapes created with nullptr meshes have no models, and are moved with SetTransform instead (e.g. in the CollisionWorld).
 struct Shape
 {
-	Model* mCentre;
+	Model* mCentre; // nullptr if the shape has no models
+	Vector2 mCentrePosition;
 
 	Vector2 GetCentrePos() const;
 	void MoveToPos(const Vector2& NewPos);
+	void UpdateCentrePos();
 };
 
-// This is for regular polygons for now.
+// Convex polygons. Vertices are stored counter-clockwise, and the outward normals are
+// calculated once from the local vertices so they only need rotating each frame.
+// Coarser levels of detail (circles around the centre and a hull with fewer sides) let most tests finish without the exact polygon.
 struct Polygon : public Shape
 {
 	//Model* mCentre;
 	std::vector<Model*> mVertices;
 	std::vector<Vector2> mVerticesPositions;
 	std::vector<Vector2> mAxes;
+	std::vector<Vector2> mLocalVerticesPositions; // Relative to the centre, counter-clockwise
+	std::vector<Vector2> mLocalAxes; // Outward normals of the local vertices
+	float mInvFirstSideLengthSquared; // Used to find the rotation of the shape from its first side
+	float mInnerRadius; // Largest circle around the centre that is inside the polygon
+	float mOuterRadius; // Smallest circle around the centre that contains the polygon
+	std::vector<Vector2> mCoarseVerticesPositions; // Hull with fewer sides that contains the polygon. Empty if the polygon has few sides already.
+	std::vector<Vector2> mCoarseAxes;
+	std::vector<Vector2> mLocalCoarseVerticesPositions;
+	std::vector<Vector2> mLocalCoarseAxes;
 
 	void InitialiseShape(Mesh* DummyMesh, Mesh* CornerMesh, const int NumSides, const float SideLength);
+	bool InitialiseFromPoints(Mesh* DummyMesh, Mesh* CornerMesh, const std::vector<Vector2>& Points, const float Tolerance = 0.0f);
+	bool InitialiseLocalVertices(Mesh* DummyMesh, Mesh* CornerMesh, const std::vector<Vector2>& LocalPoints);
+	void InitialiseLevelsOfDetail();
 	void UpdateVerticesPosition();
 	void UpdateAxes();
+	void UpdateCoarseHull(const float& Cos, const float& Sin);
+	void SetTransform(const Vector2& Position, const float& Cos, const float& Sin);
+	BoundingBox GetBoundingBox() const;
 };
 
 struct Circle : public Shape
 {
 	//Model* mCentre;
 	float mRadius;
-	Vector2 mCentrePosition;
-	Vector2 mAxis;
 
 	void InitialiseCircle(Mesh* CentreMesh, const float Radius);
-	void UpdateCentrePos();
-	void UpdateAxis(Polygon& Poly);
+	Vector2 GetAxis(const Polygon& Poly) const;
+	void SetTransform(const Vector2& Position, const float& Cos, const float& Sin);
+	BoundingBox GetBoundingBox() const;
 };
 
 struct Square
@@ -90,6 +174,52 @@ struct Square
 	void UpdateAxesArray();
 };
 
+// Axis aligned box. Only needs interval comparisons, so ignores any rotation of its centre model.
+struct AABB : public Shape
+{
+	//Model* mCentre;
+	Model* mCorners[SquareNumCorners];
+	Vector2 mHalfSize;
+
+	void InitialiseAABB(Mesh* DummyMesh, Mesh* CornerMesh, const Vector2& HalfSize);
+	void SetTransform(const Vector2& Position, const float& Cos, const float& Sin);
+	BoundingBox GetBoundingBox() const;
+};
+
+// Oriented box. Like Square, only 2 axes need checking because the other 2 sides are parallel.
+struct OBB : public Shape
+{
+	//Model* mCentre;
+	Model* mCorners[SquareNumCorners]; // 0-+, 1++, 2+-, 3-- in local space, same as Square
+	Vector2 mHalfSize;
+	Vector2 mAxes[SquareNumAxesToCheck]; // Local X and local Z in world space
+
+	void InitialiseOBB(Mesh* DummyMesh, Mesh* CornerMesh, const Vector2& HalfSize);
+	void UpdateAxes();
+	void SetTransform(const Vector2& Position, const float& Cos, const float& Sin);
+	void GetCornersPositions(Vector2 Corners[SquareNumCorners]) const;
+	BoundingBox GetBoundingBox() const;
+};
+
+// Line segment along local X with a radius around it (a rectangle with round ends).
+struct Capsule : public Shape
+{
+	//Model* mCentre;
+	Model* mEnds[2];
+	float mHalfLength;
+	float mRadius;
+	Vector2 mEndsPositions[2];
+
+	void InitialiseCapsule(Mesh* DummyMesh, Mesh* EndMesh, const float HalfLength, const float Radius);
+	void UpdateEndsPosition();
+	void SetTransform(const Vector2& Position, const float& Cos, const float& Sin);
+	BoundingBox GetBoundingBox() const;
+};
+
+// Levels of detail of a polygon, from coarsest to exact
+enum EPolygonLevel { eLevelNone = -1, eLevelOuterCircles, eLevelInnerCircles, eLevelCoarseHulls, eLevelExact, eNumPolygonLevels };
+const char* const PolygonLevelNames[eNumPolygonLevels] = { "outer circles", "inner circles", "coarse hulls", "exact" };
+
 // Minimum information needed to resolve a collision
 // Supported by https://research.ncl.ac.uk/game/mastersdegree/gametechnologies/previousinformation/physics4collisiondetection/2017%20Tutorial%204%20-%20Collision%20Detection.pdf
 // Page 4-5
@@ -97,12 +227,469 @@ struct CollisionData
 {
 	float mPenetration; // minimum distance along the normal the intersecting object must move
 	Vector2 mNormal; // the direction vector along which the intersecting object must move to resolve the collision
+	Vector2 mSeparatingAxis; // an axis the objects don't overlap on, if they aren't colliding
+	EPolygonLevel mPolygonLevel; // level of detail that decided a test between two polygons, eLevelNone for other tests
 	//Vector2 mPointOnPlane; // the contact point where the collision is detected
 
 	void InitialiseData();
 	void UpdateData(const Vector2& Axis, const float& Min1, const float& Max1, const float& Min2, const float& Max2);
+	void UpdateData(const Vector2& Axis, const float& Depth);
+	void OrientNormal(const Vector2& SecondToFirst);
+};
+
+// One convex piece of a compound shape. Index is into the compound's polygons or circles.
+struct CompoundPart
+{
+	bool mIsCircle;
+	int mIndex;
+	BoundingBox mLocalBox; // Relative to the compound's centre
+};
+
+// Node of a compound shape's bounding hierarchy. Leaves have a part, other nodes have two children.
+struct BoundingNode
+{
+	BoundingBox mLocalBox;
+	int mLeft;
+	int mRight;
+	int mPart; // -1 if not a leaf
+};
+
+// Convex pieces of a concave outline, stored so each outline is only split once.
+struct CachedDecomposition
+{
+	size_t mHash;
+	std::vector<Vector2> mOutline;
+	std::vector<std::vector<Vector2>> mPieces;
+};
+
+struct ConvexDecompositionCache
+{
+	std::vector<CachedDecomposition> mEntries;
+
+	const std::vector<std::vector<Vector2>>* GetPieces(const std::vector<Vector2>& Outline);
+};
+
+// A shape made of several convex polygons and circles, which can be concave overall.
+// Each part's centre model is attached to the compound's centre, so the parts move and rotate with it.
+// The bounding hierarchy is built in local space once all parts are added, so it never needs rebuilding.
+struct CompoundShape : public Shape
+{
+	//Model* mCentre;
+	Model* mReference; // Dummy one unit along local X, used to find the rotation of the compound
+	std::vector<Polygon> mPolygons;
+	std::vector<Circle> mCircles;
+	std::vector<CompoundPart> mParts;
+	std::vector<BoundingNode> mNodes; // Node 0 is the root
+	std::vector<int> mFoundParts; // Results of the last QueryParts, kept to reuse its memory
+
+	void InitialiseCompound(Mesh* CentreMesh, Mesh* DummyMesh);
+	bool AddPolygon(Mesh* DummyMesh, Mesh* CornerMesh, const std::vector<Vector2>& LocalPoints);
+	void AddCircle(Mesh* CentreMesh, const float Radius, const Vector2& LocalPos);
+	bool AddConcaveOutline(Mesh* DummyMesh, Mesh* CornerMesh, const std::vector<Vector2>& Outline, ConvexDecompositionCache& Cache);
+	void BuildHierarchy();
+	int BuildNode(std::vector<int>& PartIndices, const int First, const int Last);
+	void QueryParts(const BoundingBox& WorldBox);
+	void SetPartsSkin(const std::string& SkinName);
+	BoundingBox GetBoundingBox() const;
+};
+
+// Number of allocations made by the whole program through operator new, so the headless runs can check that
+// stepping stops allocating once warmed up. Includes allocations made by the standard library and other threads.
+std::atomic<long long> NumHeapAllocations = 0;
+
+// Every form is replaced, as the compiler calls the sized, aligned and nothrow forms directly rather than through these.
+void* operator new(const std::size_t Size)
+{
+	NumHeapAllocations++;
+	void* Memory = std::malloc(Size == 0 ? 1 : Size);
+	if (Memory == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+	return Memory;
+}
+
+void operator delete(void* Memory) noexcept
+{
+	std::free(Memory);
+}
+
+void* operator new[](const std::size_t Size)
+{
+	return operator new(Size);
+}
+
+void operator delete[](void* Memory) noexcept
+{
+	operator delete(Memory);
+}
+
+void operator delete(void* Memory, std::size_t) noexcept
+{
+	operator delete(Memory);
+}
+
+void operator delete[](void* Memory, std::size_t) noexcept
+{
+	operator delete(Memory);
+}
+
+// Types aligned to more than the default. The memory is allocated with room to move it up to the alignment,
+// and the pointer malloc returned is stored just before the memory handed out, so delete can free it.
+void* operator new(const std::size_t Size, const std::align_val_t Alignment)
+{
+	const std::size_t AlignmentBytes = static_cast<std::size_t>(Alignment);
+	void* Block = operator new(Size + AlignmentBytes + sizeof(void*));
+	const std::size_t Start = reinterpret_cast<std::size_t>(Block) + sizeof(void*);
+	void* Memory = reinterpret_cast<void*>((Start + AlignmentBytes - 1) & ~(AlignmentBytes - 1));
+	static_cast<void**>(Memory)[-1] = Block;
+	return Memory;
+}
+
+void operator delete(void* Memory, std::align_val_t) noexcept
+{
+	if (Memory != nullptr)
+	{
+		operator delete(static_cast<void**>(Memory)[-1]);
+	}
+}
+
+void* operator new[](const std::size_t Size, const std::align_val_t Alignment)
+{
+	return operator new(Size, Alignment);
+}
+
+void operator delete[](void* Memory, const std::align_val_t Alignment) noexcept
+{
+	operator delete(Memory, Alignment);
+}
+
+void operator delete(void* Memory, std::size_t, const std::align_val_t Alignment) noexcept
+{
+	operator delete(Memory, Alignment);
+}
+
+void operator delete[](void* Memory, std::size_t, const std::align_val_t Alignment) noexcept
+{
+	operator delete(Memory, Alignment);
+}
+
+// Nothrow forms return nullptr instead of throwing if there is no memory
+void* operator new(const std::size_t Size, const std::nothrow_t&) noexcept
+{
+	try
+	{
+		return operator new(Size);
+	}
+	catch (const std::bad_alloc&)
+	{
+		return nullptr;
+	}
+}
+
+void* operator new[](const std::size_t Size, const std::nothrow_t&) noexcept
+{
+	return operator new(Size, std::nothrow);
+}
+
+void* operator new(const std::size_t Size, const std::align_val_t Alignment, const std::nothrow_t&) noexcept
+{
+	try
+	{
+		return operator new(Size, Alignment);
+	}
+	catch (const std::bad_alloc&)
+	{
+		return nullptr;
+	}
+}
+
+void* operator new[](const std::size_t Size, const std::align_val_t Alignment, const std::nothrow_t&) noexcept
+{
+	return operator new(Size, Alignment, std::nothrow);
+}
+
+void operator delete(void* Memory, const std::nothrow_t&) noexcept
+{
+	operator delete(Memory);
+}
+
+void operator delete[](void* Memory, const std::nothrow_t&) noexcept
+{
+	operator delete(Memory);
+}
+
+void operator delete(void* Memory, const std::align_val_t Alignment, const std::nothrow_t&) noexcept
+{
+	operator delete(Memory, Alignment);
+}
+
+void operator delete[](void* Memory, const std::align_val_t Alignment, const std::nothrow_t&) noexcept
+{
+	operator delete(Memory, Alignment);
+}
+
+// Fixed size items handed out by index, with freed items reused before the pool grows.
+// Indices stay valid when the pool grows, unlike pointers.
+template<typename T>
+struct PoolAllocator
+{
+	std::vector<T> mItems;
+	std::vector<int> mFreeItems;
+	int mNumGrowths = 0;
+
+	int Allocate();
+	void Free(const int Index);
+	void Reserve(const int NumItems);
+};
+
+// Bump allocator for memory that only lasts one frame. Reset frees everything at once.
+// If a frame needs more than the block, extra blocks are used, and the block grows on the next Reset.
+struct FrameArena
+{
+	unsigned char* mBlock = nullptr;
+	std::size_t mBlockSize = 0;
+	std::size_t mUsed = 0;
+	std::vector<unsigned char*> mOverflowBlocks;
+	std::size_t mOverflowSize = 0;
+	int mNumGrowths = 0;
+
+	FrameArena() = default;
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+	~FrameArena();
+
+	void* Allocate(const std::size_t Size, const std::size_t Alignment);
+	template<typename T> T* AllocateArray(const int Count);
+	void Reset();
+	void Release();
+};
+
+// Shape types the collision world can hold
+enum EShapeType { eShapeCircle, eShapePolygon, eShapeAABB, eShapeOBB, eShapeCapsule, eNumShapeTypes };
+const int NumShapePairTypes = eNumShapeTypes * eNumShapeTypes;
+
+// A shape in the collision world. The shape itself is in the world's array for its type.
+struct CollisionBody
+{
+	EShapeType mType;
+	int mShapeIndex;
+	Vector2 mPosition;
+	float mRotation; // Degrees, counter-clockwise
+	Vector2 mVelocity;
+	float mAngularVelocity; // Degrees per second
+	bool mIsStatic;
+	BoundingBox mBox;
+};
+
+// State kept between frames for a pair of bodies whose bounding boxes overlap
+struct PairCacheEntry
+{
+	int mFirstBody; // Ordered by shape type, then by body index, so pairs of the same types always have the same order
+	int mSecondBody;
+	int mNext; // Next entry in the same hash bucket, -1 if last
+	int mLastFrame; // Frame the broadphase last found this pair
+	bool mInUse;
+	bool mIsColliding;
+	bool mHasSeparatingAxis;
+	CollisionData mData; // Last contact, normal from the second body to the first
+};
+
+// Hash table of body pairs, with entries from a pool so no memory is allocated once all pairs have been seen.
+struct PairCache
+{
+	PoolAllocator<PairCacheEntry> mEntries;
+	std::vector<int> mBuckets; // First entry in each bucket, -1 if empty. Size is a power of 2.
+	int mNumEntries = 0;
+	int mNumGrowths = 0;
+
+	int FindOrAdd(const int FirstBody, const int SecondBody);
+	void Remove(const int EntryIndex);
+	int GetBucket(const int FirstBody, const int SecondBody) const;
+	void Rehash(const int NumBuckets);
+	void Reserve(const int NumPairs);
+};
+
+// Threads that wait for jobs, so parallel work doesn't pay for starting threads each time.
+// The thread that runs a job works on it too.
+struct WorkerPool
+{
+	std::vector<std::thread> mThreads;
+	std::mutex mMutex;
+	std::condition_variable mJobReady;
+	std::condition_variable mJobDone;
+	void (*mJob)(void* Context, const int First, const int Last) = nullptr;
+	void* mJobContext = nullptr;
+	int mNumItems = 0;
+	int mChunkSize = 1;
+	std::atomic<int> mNextItem = 0;
+	int mNumWorking = 0;
+	int mJobNumber = 0;
+	bool mStopping = false;
+
+	~WorkerPool();
+	void Initialise(const int NumThreads);
+	void Shutdown();
+	void Run(void (*Job)(void* Context, const int First, const int Last), void* Context, const int NumItems, const int ChunkSize);
+	void RunChunks();
+	void WorkerLoop(const int StartJobNumber);
+
+	// Calls Function(First, Last) on chunks of the items, split between the threads
+	template<typename T>
+	void ParallelFor(const int NumItems, const int ChunkSize, T& Function)
+	{
+		Run([](void* Context, const int First, const int Last) { (*static_cast<T*>(Context))(First, Last); }, &Function, NumItems, ChunkSize);
+	}
+};
+
+// Ray from Origin along Direction (must be normalised), up to MaxDistance
+struct RayQuery
+{
+	Vector2 mOrigin;
+	Vector2 mDirection;
+	float mMaxDistance;
+	int mIgnoreBody; // Body the ray can't hit, e.g. the one it starts from. -1 for none.
+};
+
+// Convex polygon (created without models, and moved with SetTransform) swept along Direction (must be normalised), up to MaxDistance
+struct ShapeCastQuery
+{
+	const Polygon* mShape;
+	Vector2 mDirection;
+	float mMaxDistance;
+	int mIgnoreBody;
+};
+
+// Closest hit of a ray or shape cast
+struct QueryHit
+{
+	int mBody; // -1 if nothing was hit
+	float mDistance; // 0 if the query started overlapping the body
+	Vector2 mNormal; // Surface normal of the body, pointing back towards the query
+};
+
+// Statistics from the last CollisionWorld::Step
+struct WorldStepStats
+{
+	int mNumPairs; // Bounding boxes overlap
+	int mNumCachedAxisRejects; // Separated on the axis cached from the last frame, so no SAT needed
+	int mNumCollisions;
+	int mNumPolygonTests[eNumPolygonLevels]; // Tests between two polygons decided at each level of detail
+};
+
+// Collision world that runs without the engine. Bodies move with their velocity, and collisions push them apart.
+// All memory comes from the pair cache pool and frame arena, so once warmed up a step makes no allocations.
+struct CollisionWorld
+{
+	std::vector<Circle> mCircles;
+	std::vector<Polygon> mPolygons;
+	std::vector<AABB> mAABBs;
+	std::vector<OBB> mOBBs;
+	std::vector<Capsule> mCapsules;
+	std::vector<CollisionBody> mBodies;
+	std::vector<int> mSortedBodies; // Body indices sorted by the left of their bounding box
+	PairCache mPairCache;
+	FrameArena mArena;
+	int mFrame = 0;
+	WorldStepStats mStats = {};
+
+	// Bounding boxes for queries, padded to multiples of 4
+	std::vector<float> mQueryMinX;
+	std::vector<float> mQueryMinY;
+	std::vector<float> mQueryMaxX;
+	std::vector<float> mQueryMaxY;
+	std::vector<int> mQueryBodies;
+	int mQueryNumWideSlots = 0; // Wide bodies are in the first slots, checked by every query
+	int mQueryFirstNarrow = 0; // Other bodies follow, sorted by the left of their box
+	int mQueryLastNarrow = 0;
+	float mQueryMaxWidth = 0.0f; // Widest of the other bodies
+	int mQueryFrame = -1; // Frame the query boxes were made for
+	WorkerPool mWorkers;
+
+	int AddBody(const Circle& NewShape, const Vector2& Position, const float Rotation, const bool bIsStatic);
+	int AddBody(const Polygon& NewShape, const Vector2& Position, const float Rotation, const bool bIsStatic);
+	int AddBody(const AABB& NewShape, const Vector2& Position, const float Rotation, const bool bIsStatic);
+	int AddBody(const OBB& NewShape, const Vector2& Position, const float Rotation, const bool bIsStatic);
+	int AddBody(const Capsule& NewShape, const Vector2& Position, const float Rotation, const bool bIsStatic);
+	int AddBody(const EShapeType Type, const int ShapeIndex, const Vector2& Position, const float Rotation, const bool bIsStatic);
+	void Step(const float DeltaTime);
+	void UpdateBody(CollisionBody& Body);
+	bool CollideBodies(const int FirstBody, const int SecondBody, CollisionData& Data);
+	void StorePairResult(PairCacheEntry& Entry, const bool bColliding, const CollisionData& Data);
+	void ProjectBody(const CollisionBody& Body, const Vector2& Axis, float& Min, float& Max) const;
+	void ResolveCollision(CollisionBody& First, CollisionBody& Second, const CollisionData& Data);
+
+	void InitialiseWorkers(const int NumThreads);
+	void PrepareQueries();
+	void GetQueryRange(const float MinX, const float MaxX, int& First, int& Last) const;
+	void RaycastBatch(const RayQuery* Rays, const int NumRays, QueryHit* Hits);
+	void ShapeCastBatch(const ShapeCastQuery* Casts, const int NumCasts, QueryHit* Hits);
+	void Raycast(const RayQuery& Ray, QueryHit& Hit) const;
+	void ShapeCast(const ShapeCastQuery& Cast, QueryHit& Hit) const;
+	void RaycastAllBodies(const RayQuery& Ray, QueryHit& Hit, float& NextDistance) const;
+	void ShapeCastAllBodies(const ShapeCastQuery& Cast, QueryHit& Hit, float& NextDistance) const;
+	void CastOutlineAllBodies(const std::vector<Vector2>& CastCorners, const Vector2& Direction, const float MaxDistance, const int IgnoreBody,
+		QueryHit& Hit, float& NextDistance) const;
+	void GetBodyOutline(const CollisionBody& Body, std::vector<Vector2>& Corners, float& Radius) const;
+	template<typename T> void SweepQuerySlots(const Vector2& Origin, const Vector2& Direction, const Vector2& HalfSize, const int IgnoreBody,
+		QueryHit& Hit, T& TestBody) const;
+	bool RayToBody(const CollisionBody& Body, const Vector2& Origin, const Vector2& Direction, const float MaxDistance, float& Distance, Vector2& Normal) const;
+	bool ShapeCastToBody(const CollisionBody& Body, const Polygon& CastShape, const Vector2& Direction, const float MaxDistance, float& Distance, Vector2& Normal) const;
+};
+
+// Agent in a crowd. Agent i is body i in the crowd's collision world.
+struct CrowdAgent
+{
+	Vector2 mGoal;
+	float mMaxSpeed;
+	unsigned int mRandomState; // Each agent picks its own goals, so agents can be steered on any thread
+	int mCell;
+};
+
+// Statistics from the last CrowdWorld::Step. Pairs are found by both agents, so are counted twice.
+struct CrowdStepStats
+{
+	int mNumPairs; // Bounding boxes overlap
+	int mNumCollisions;
+	int mNumPolygonTests[eNumPolygonLevels]; // Tests between two polygons decided at each level of detail
+};
+
+// Lots of agents (circles and small polygons) that walk to random goals and push each other apart, split between the world's worker threads.
+// Neighbours are found from a grid rebuilt each step instead of the pair cache. Each agent tests all its neighbours and
+// only moves itself, so every step gives the same result however many threads there are.
+struct CrowdWorld
+{
+	CollisionWorld mWorld;
+	std::vector<CrowdAgent> mAgents;
+	std::vector<Vector2> mPushes; // Push out of the other agents, found this step
+	std::vector<int> mCellStarts; // First slot of each cell, then the end of the last cell
+	std::vector<int> mCellAgents; // Agents in order of cell
+	std::vector<BoundingBox> mCellBoxes; // Bounding box of the agent in each slot, so neighbours are checked from one array
+	float mHalfArea = 0.0f;
+	float mCellSize = 0.0f; // At least the widest agent, so agents that overlap are in the same or next cells
+	int mGridWidth = 0;
+	CrowdStepStats mStats = {};
+
+	void Initialise(const float HalfArea, const float CellSize, const int MaxAgents);
+	int AddAgent(const Circle& NewShape, const Vector2& Position, const float MaxSpeed, const unsigned int Seed);
+	int AddAgent(const Polygon& NewShape, const Vector2& Position, const float MaxSpeed, const unsigned int Seed);
+	void Step(const float DeltaTime);
+	void SteerAgents(const int First, const int Last, const float DeltaTime);
+	void BuildGrid();
+	void CollideAgents(const int FirstRow, const int LastRow, CrowdStepStats& Stats);
+	void ApplyPushes(const int First, const int Last);
+	int GetCell(const Vector2& Position) const;
+	Vector2 PickGoal(CrowdAgent& Agent) const;
+
+private:
+	// Agent i must be body i, so this is only called with the body just added for the agent
+	int AddAgent(const int Body, const float MaxSpeed, const unsigned int Seed);
 };
 
+// Convex hull prototypes
+std::vector<Vector2> ConvexHull(std::vector<Vector2> Points);
+void SimplifyConvexHull(std::vector<Vector2>& Hull, const float Tolerance);
+
 // SAT for Squares function prototype
 bool TwoSquaresSAT(Square& Sq1, Square& Sq2);
 bool CheckCollisionAxisSquares(const Vector2& Axis, const Square& Sq1, const Square& Sq2);
@@ -110,16 +697,259 @@ void GetMinMaxVertexOnAxisSquare(const Vector2& Axis, const Square& Sq, float& M
 
 // SAT for Shapes function prototypes
 bool TwoShapesSAT(Polygon& First, Polygon& Second, CollisionData& Data);
+bool TwoShapesExactSAT(const Polygon& First, const Polygon& Second, CollisionData& Data);
 bool CheckCollisionAxisShapes(const Vector2& Axis, const Polygon& First, const Polygon& Second, CollisionData& Data);
 void GetMinMaxVertexOnAxisShape(const Vector2& Axis, const Polygon& Shape, float& Min, float& Max);
+bool CoarseHullsSeparated(const Polygon& First, const Polygon& Second, CollisionData& Data);
+void GetMinMaxVertexOnAxis(const Vector2& Axis, const std::vector<Vector2>& Vertices, float& Min, float& Max);
 
 // SAT for Circles prototypes
 bool ShapeToCircleSAT(Polygon& FirstPolygon, Circle& SecondCircle, CollisionData& Data);
 bool CheckCollisionAxisShapeCircle(const Vector2& Axis, const Polygon& Poly, const Circle& Circ, CollisionData& Data);
 void GetMinMaxVertexOnAxisCircle(const Vector2& Axis, const Circle& Circ, float& Min, float& Max);
+bool TwoCirclesSAT(Circle& First, Circle& Second, CollisionData& Data);
+
+// SAT for boxes and capsules prototypes
+bool TwoAABBsSAT(AABB& First, AABB& Second, CollisionData& Data);
+bool AABBToOBBSAT(AABB& First, OBB& Second, CollisionData& Data);
+bool AABBToCircleSAT(AABB& FirstBox, Circle& SecondCircle, CollisionData& Data);
+bool AABBToCapsuleSAT(AABB& FirstBox, Capsule& SecondCapsule, CollisionData& Data);
+bool ShapeToAABBSAT(Polygon& FirstPolygon, AABB& SecondBox, CollisionData& Data);
+bool TwoOBBsSAT(OBB& First, OBB& Second, CollisionData& Data);
+bool OBBToCircleSAT(OBB& FirstBox, Circle& SecondCircle, CollisionData& Data);
+bool OBBToCapsuleSAT(OBB& FirstBox, Capsule& SecondCapsule, CollisionData& Data);
+bool ShapeToOBBSAT(Polygon& FirstPolygon, OBB& SecondBox, CollisionData& Data);
+bool TwoCapsulesSAT(Capsule& First, Capsule& Second, CollisionData& Data);
+bool CapsuleToCircleSAT(Capsule& FirstCapsule, Circle& SecondCircle, CollisionData& Data);
+bool ShapeToCapsuleSAT(Polygon& FirstPolygon, Capsule& SecondCapsule, CollisionData& Data);
+bool CheckOverlapOnAxis(const Vector2& Axis, const float& Min1, const float& Max1, const float& Min2, const float& Max2, CollisionData& Data);
+void GetMinMaxOnAxisBox(const Vector2& Axis, const Vector2& Centre, const Vector2 BoxAxes[SquareNumAxesToCheck], const Vector2& HalfSize, float& Min, float& Max);
+void GetMinMaxOnAxisCapsule(const Vector2& Axis, const Capsule& Cap, float& Min, float& Max);
+Vector2 ClosestPointOnSegment(const Vector2& Point, const Vector2& Start, const Vector2& End);
+void ClosestPointsBetweenSegments(const Vector2& P1, const Vector2& Q1, const Vector2& P2, const Vector2& Q2, Vector2& Closest1, Vector2& Closest2);
+bool BoxesSAT(const Vector2& Centre1, const Vector2 Axes1[SquareNumAxesToCheck], const Vector2& HalfSize1,
+	const Vector2& Centre2, const Vector2 Axes2[SquareNumAxesToCheck], const Vector2& HalfSize2, CollisionData& Data);
+bool BoxToCircleSAT(const Vector2& Centre, const Vector2 Axes[SquareNumAxesToCheck], const Vector2& HalfSize, Circle& Circ, CollisionData& Data);
+bool ConvexToCapsuleSAT(const Vector2* Vertices, const int NumVertices, const Vector2* Axes, const int NumAxes, const Vector2& Centre, Capsule& Cap, CollisionData& Data);
+
+// Convex decomposition prototypes
+bool SegmentsTouch(const Vector2& A, const Vector2& B, const Vector2& C, const Vector2& D);
+std::vector<std::vector<Vector2>> ConvexDecomposition(const std::vector<Vector2>& Outline);
+
+// SAT for Compounds prototypes
+template<typename ShapeType>
+bool ShapeToCompoundPartsSAT(ShapeType& FirstShape, const BoundingBox& FirstBox, CompoundShape& SecondCompound, CollisionData& Data);
+bool ShapeToCompoundSAT(Polygon& FirstPolygon, CompoundShape& SecondCompound, CollisionData& Data);
+bool CompoundToCircleSAT(CompoundShape& FirstCompound, Circle& SecondCircle, CollisionData& Data);
+bool AABBToCompoundSAT(AABB& FirstBox, CompoundShape& SecondCompound, CollisionData& Data);
+bool OBBToCompoundSAT(OBB& FirstBox, CompoundShape& SecondCompound, CollisionData& Data);
+bool CapsuleToCompoundSAT(Capsule& FirstCapsule, CompoundShape& SecondCompound, CollisionData& Data);
+bool TwoCompoundsSAT(CompoundShape& First, CompoundShape& Second, CollisionData& Data);
+
+// Query prototypes
+bool SweepIntervalOnAxis(const Vector2& Axis, const float& Min1, const float& Max1, const float& Speed, const float& Min2, const float& Max2,
+	float& Enter, float& Exit, Vector2& Normal);
+bool RayToCircle(const Vector2& Origin, const Vector2& Direction, const float MaxDistance, const Vector2& Centre, const float Radius,
+	float& Distance, Vector2& Normal);
+bool PolygonCastToCircle(const Polygon& CastShape, const Vector2& Direction, const float MaxDistance, const Vector2& Centre, const float Radius,
+	float& Distance, Vector2& Normal);
+bool PointCastToRoundedSide(const Vector2& Point, const Vector2& Direction, const Vector2& A, const Vector2& B, const float Radius,
+	const float MaxDistance, float& Distance, Vector2& Normal);
+float PointToOutlineDistance(const Vector2& Point, const std::vector<Vector2>& Corners);
+bool SidesCross(const Vector2& A, const Vector2& B, const Vector2& C, const Vector2& D);
+bool OutlineCastToOutline(const std::vector<Vector2>& CastCorners, const Vector2& Direction, const std::vector<Vector2>& Corners, const float Radius,
+	const float MaxDistance, float& Distance, Vector2& Normal);
+void InitialiseHit(QueryHit& Hit, const float MaxDistance);
+bool SameQueryHit(const QueryHit& Hit, const QueryHit& Expected, const float NextDistance);
+
+// Headless world prototypes
+bool RunHeadlessWorld();
+bool RunCrowdWorld();
+void PrintPolygonTests(const long long NumPolygonTests[eNumPolygonLevels], const long long NumSteps);
+bool CheckPolygonLevels(std::mt19937& Random);
+
+// Shape pair dispatch
+// PairKernel<First, Second>::Test calls the test for the two shape types, with the normal pointing from Second to First.
+// Each test takes its shapes in one order. That order is specialised below, and the other order uses the general
+// version, which swaps the shapes and reverses the normal, so the argument order is sorted out at compile time.
+template<typename First, typename Second>
+struct PairKernel;
+
+// Whether Kernel is a specialisation of PairKernel, rather than the general version
+template<typename Kernel, typename = void>
+struct IsPairKernelSpecialised : std::false_type {};
+
+template<typename Kernel>
+struct IsPairKernelSpecialised<Kernel, std::void_t<decltype(Kernel::bSpecialised)>> : std::true_type {};
+
+template<typename First, typename Second>
+struct PairKernel
+{
+	static bool Test(First& FirstShape, Second& SecondShape, CollisionData& Data)
+	{
+		static_assert(IsPairKernelSpecialised<PairKernel<Second, First>>::value, "No test for these two shape types in either order");
+
+		const bool bColliding = PairKernel<Second, First>::Test(SecondShape, FirstShape, Data);
+		Data.mNormal.Reverse();
+		return bColliding;
+	}
+};
+
+// Base of each specialisation of PairKernel, for the order TestFunction takes its shapes in
+template<typename First, typename Second, bool (*TestFunction)(First&, Second&, CollisionData&)>
+struct PairKernelFor
+{
+	static constexpr bool bSpecialised = true;
+
+	static bool Test(First& FirstShape, Second& SecondShape, CollisionData& Data)
+	{
+		return TestFunction(FirstShape, SecondShape, Data);
+	}
+};
+
+template<> struct PairKernel<Circle, Circle> : PairKernelFor<Circle, Circle, TwoCirclesSAT> {};
+template<> struct PairKernel<Polygon, Circle> : PairKernelFor<Polygon, Circle, ShapeToCircleSAT> {};
+template<> struct PairKernel<Polygon, Polygon> : PairKernelFor<Polygon, Polygon, TwoShapesSAT> {};
+template<> struct PairKernel<Polygon, AABB> : PairKernelFor<Polygon, AABB, ShapeToAABBSAT> {};
+template<> struct PairKernel<Polygon, OBB> : PairKernelFor<Polygon, OBB, ShapeToOBBSAT> {};
+template<> struct PairKernel<Polygon, Capsule> : PairKernelFor<Polygon, Capsule, ShapeToCapsuleSAT> {};
+template<> struct PairKernel<Polygon, CompoundShape> : PairKernelFor<Polygon, CompoundShape, ShapeToCompoundSAT> {};
+template<> struct PairKernel<AABB, Circle> : PairKernelFor<AABB, Circle, AABBToCircleSAT> {};
+template<> struct PairKernel<AABB, AABB> : PairKernelFor<AABB, AABB, TwoAABBsSAT> {};
+template<> struct PairKernel<AABB, OBB> : PairKernelFor<AABB, OBB, AABBToOBBSAT> {};
+template<> struct PairKernel<AABB, Capsule> : PairKernelFor<AABB, Capsule, AABBToCapsuleSAT> {};
+template<> struct PairKernel<OBB, Circle> : PairKernelFor<OBB, Circle, OBBToCircleSAT> {};
+template<> struct PairKernel<OBB, OBB> : PairKernelFor<OBB, OBB, TwoOBBsSAT> {};
+template<> struct PairKernel<OBB, Capsule> : PairKernelFor<OBB, Capsule, OBBToCapsuleSAT> {};
+template<> struct PairKernel<Capsule, Circle> : PairKernelFor<Capsule, Circle, CapsuleToCircleSAT> {};
+template<> struct PairKernel<Capsule, Capsule> : PairKernelFor<Capsule, Capsule, TwoCapsulesSAT> {};
+template<> struct PairKernel<CompoundShape, Circle> : PairKernelFor<CompoundShape, Circle, CompoundToCircleSAT> {};
+template<> struct PairKernel<AABB, CompoundShape> : PairKernelFor<AABB, CompoundShape, AABBToCompoundSAT> {};
+template<> struct PairKernel<OBB, CompoundShape> : PairKernelFor<OBB, CompoundShape, OBBToCompoundSAT> {};
+template<> struct PairKernel<Capsule, CompoundShape> : PairKernelFor<Capsule, CompoundShape, CapsuleToCompoundSAT> {};
+template<> struct PairKernel<CompoundShape, CompoundShape> : PairKernelFor<CompoundShape, CompoundShape, TwoCompoundsSAT> {};
+
+// Struct for each shape type in the collision world, and where the world keeps them
+template<EShapeType Type> struct ShapeOfType;
+
+template<> struct ShapeOfType<eShapeCircle>
+{
+	using Type = Circle;
+	static Circle& Get(CollisionWorld& World, const int Index) { return World.mCircles[Index]; }
+};
+
+template<> struct ShapeOfType<eShapePolygon>
+{
+	using Type = Polygon;
+	static Polygon& Get(CollisionWorld& World, const int Index) { return World.mPolygons[Index]; }
+};
+
+template<> struct ShapeOfType<eShapeAABB>
+{
+	using Type = AABB;
+	static AABB& Get(CollisionWorld& World, const int Index) { return World.mAABBs[Index]; }
+};
+
+template<> struct ShapeOfType<eShapeOBB>
+{
+	using Type = OBB;
+	static OBB& Get(CollisionWorld& World, const int Index) { return World.mOBBs[Index]; }
+};
+
+template<> struct ShapeOfType<eShapeCapsule>
+{
+	using Type = Capsule;
+	static Capsule& Get(CollisionWorld& World, const int Index) { return World.mCapsules[Index]; }
+};
+
+// Test for two bodies whose shape types are known at compile time
+template<EShapeType FirstType, EShapeType SecondType>
+bool CollideBodyPair(CollisionWorld& World, const CollisionBody& First, const CollisionBody& Second, CollisionData& Data)
+{
+	return PairKernel<typename ShapeOfType<FirstType>::Type, typename ShapeOfType<SecondType>::Type>::Test(
+		ShapeOfType<FirstType>::Get(World, First.mShapeIndex), ShapeOfType<SecondType>::Get(World, Second.mShapeIndex), Data);
+}
 
-int main()
+// Tests every pair in a bucket of the pair cache, where all pairs have the same shape types, through the one test.
+// Pairs are ordered by shape type, so FirstType is never more than SecondType.
+template<EShapeType FirstType, EShapeType SecondType>
+void CollidePairBucket(CollisionWorld& World, const int* Pairs, const int NumPairs)
 {
+	for (int i = 0; i < NumPairs; i++)
+	{
+		PairCacheEntry& Entry = World.mPairCache.mEntries.mItems[Pairs[i]];
+
+		CollisionData Data;
+		Data.InitialiseData();
+		const bool bColliding = CollideBodyPair<FirstType, SecondType>(World, World.mBodies[Entry.mFirstBody], World.mBodies[Entry.mSecondBody], Data);
+		World.StorePairResult(Entry, bColliding, Data);
+	}
+}
+
+using PairTestFunction = bool (*)(CollisionWorld& World, const CollisionBody& First, const CollisionBody& Second, CollisionData& Data);
+using PairBucketFunction = void (*)(CollisionWorld& World, const int* Pairs, const int NumPairs);
+
+// Tables with an entry for every pair of shape types, indexed by FirstType * eNumShapeTypes + SecondType
+template<int... PairTypes>
+constexpr std::array<PairTestFunction, NumShapePairTypes> MakePairTestTable(std::integer_sequence<int, PairTypes...>)
+{
+	return { &CollideBodyPair<static_cast<EShapeType>(PairTypes / eNumShapeTypes), static_cast<EShapeType>(PairTypes % eNumShapeTypes)>... };
+}
+
+template<int... PairTypes>
+constexpr std::array<PairBucketFunction, NumShapePairTypes> MakePairBucketTable(std::integer_sequence<int, PairTypes...>)
+{
+	return { &CollidePairBucket<static_cast<EShapeType>(PairTypes / eNumShapeTypes), static_cast<EShapeType>(PairTypes % eNumShapeTypes)>... };
+}
+
+constexpr std::array<PairTestFunction, NumShapePairTypes> PairTestTable = MakePairTestTable(std::make_integer_sequence<int, NumShapePairTypes>());
+constexpr std::array<PairBucketFunction, NumShapePairTypes> PairBucketTable = MakePairBucketTable(std::make_integer_sequence<int, NumShapePairTypes>());
+
+// Skin to show whether a background shape is colliding
+template<typename T>
+void SetCollisionSkin(T& Background, const bool bColliding)
+{
+	Background.mCentre->SetSkin(bColliding ? "RedBall.jpg" : "Grass1.jpg");
+}
+
+inline void SetCollisionSkin(CompoundShape& Background, const bool bColliding)
+{
+	Background.SetPartsSkin(bColliding ? "RedBall.jpg" : "Grass1.jpg");
+}
+
+// Tests the controlled shape against a background shape, shows the result on the background shape,
+// and pushes the controlled shape out. The test for the pair of types is picked at compile time.
+template<typename ControlShape, typename BackgroundShape>
+void CollideAndResolve(ControlShape& Control, BackgroundShape& Background)
+{
+	CollisionData Data;
+	Data.InitialiseData();
+
+	const bool bColliding = PairKernel<ControlShape, BackgroundShape>::Test(Control, Background, Data);
+	SetCollisionSkin(Background, bColliding);
+
+	// Normal points from the background shape to the controlled shape
+	if (bColliding)
+	{
+		Control.mCentre->MoveX(Data.mPenetration * Data.mNormal.x);
+		Control.mCentre->MoveZ(Data.mPenetration * Data.mNormal.y);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	// Run the collision world on its own, without the engine
+	if (argc > 1 && std::string(argv[1]) == "-headless")
+	{
+		return RunHeadlessWorld() ? 0 : 1;
+	}
+
+	// Run a large crowd without the engine, timed with different numbers of threads
+	if (argc > 1 && std::string(argv[1]) == "-crowd")
+	{
+		return RunCrowdWorld() ? 0 : 1;
+	}
+
 	// Create a 3D engine (using TL11 engine here) and open a window for it
 	TLEngine* myEngine = New3DEngine(TL11);
 	myEngine->StartWindowed();
@@ -135,6 +965,7 @@ int main()
 	Mesh* FloorMesh = myEngine->LoadMesh("Floor.fbx");
 	Mesh* SphereMesh = myEngine->LoadMesh("Sphere.fbx");
 	Mesh* BulletMesh = myEngine->LoadMesh("Bullet.x");
+	Mesh* DummyMesh = myEngine->LoadMesh("Dummy.x");
 
 	// Load font for text on screen
 	Font* MyFont = myEngine->LoadFont("Tahoma", 24);
@@ -146,14 +977,53 @@ int main()
 	MyCamera->RotateX(90.0f);
 
 	// Array of fixed in place shapes to test against
-	const int NumBackgroundShapes = 10;
+	// The last shape is made from the outline of a rock instead of being a regular polygon
+	const int NumRegularBackgroundShapes = 10;
+	const int NumBackgroundShapes = NumRegularBackgroundShapes + 1;
 	Polygon BackgroundShapesArray[NumBackgroundShapes];
-	for (int i = 0; i < NumBackgroundShapes; i++)
+	for (int i = 0; i < NumRegularBackgroundShapes; i++)
 	{
 		BackgroundShapesArray[i].InitialiseShape(BulletMesh, BulletMesh, i + 3, 10.0f);
 		BackgroundShapesArray[i].mCentre->SetPosition(i * 40.0f, 0.0f, 0.0f);
 	}
 
+	const std::vector<Vector2> RockOutline = { { -12.0f, -3.0f }, { -9.0f, 6.0f }, { -2.0f, 10.0f }, { 0.0f, 10.2f },
+		{ 3.0f, 10.0f }, { 11.0f, 4.0f }, { 12.0f, -2.0f }, { 6.0f, -9.0f }, { -4.0f, -8.0f }, { 0.0f, 0.0f }, { 5.0f, 2.0f } };
+	if (!BackgroundShapesArray[NumRegularBackgroundShapes].InitialiseFromPoints(BulletMesh, BulletMesh, RockOutline, 0.5f))
+	{
+		std::cerr << "Rock outline has fewer than 3 points that are not in a line, so a hexagon is used instead" << std::endl;
+		BackgroundShapesArray[NumRegularBackgroundShapes].InitialiseShape(BulletMesh, BulletMesh, 6, 10.0f);
+	}
+	BackgroundShapesArray[NumRegularBackgroundShapes].mCentre->SetPosition(NumRegularBackgroundShapes * 40.0f, 0.0f, 0.0f);
+
+	// Concave wall, split into convex parts when loaded, with a circular post
+	ConvexDecompositionCache DecompositionCache;
+	const std::vector<Vector2> WallOutline = { { -20.0f, -10.0f }, { 20.0f, -10.0f }, { 20.0f, 10.0f }, { 12.0f, 10.0f },
+		{ 12.0f, -2.0f }, { -12.0f, -2.0f }, { -12.0f, 10.0f }, { -20.0f, 10.0f } };
+	CompoundShape BackgroundWall;
+	BackgroundWall.InitialiseCompound(BulletMesh, DummyMesh);
+	if (!BackgroundWall.AddConcaveOutline(BulletMesh, BulletMesh, WallOutline, DecompositionCache))
+	{
+		std::cerr << "Wall outline could not be split into convex parts (is it self intersecting?)" << std::endl;
+	}
+	BackgroundWall.AddCircle(SphereMesh, 10.0f, { 0.0f, -22.0f });
+	BackgroundWall.BuildHierarchy();
+	BackgroundWall.mCentre->SetPosition(200.0f, 0.0f, 60.0f);
+
+	// Box and capsule obstacles, which have their own tests instead of being general polygons
+	AABB BackgroundAABB;
+	BackgroundAABB.InitialiseAABB(BulletMesh, BulletMesh, { 15.0f, 8.0f });
+	BackgroundAABB.mCentre->SetPosition(0.0f, 0.0f, -60.0f);
+
+	OBB BackgroundOBB;
+	BackgroundOBB.InitialiseOBB(BulletMesh, BulletMesh, { 12.0f, 6.0f });
+	BackgroundOBB.mCentre->SetPosition(80.0f, 0.0f, -60.0f);
+	BackgroundOBB.mCentre->RotateY(30.0f);
+
+	Capsule BackgroundCapsule;
+	BackgroundCapsule.InitialiseCapsule(BulletMesh, BulletMesh, 12.0f, 5.0f);
+	BackgroundCapsule.mCentre->SetPosition(160.0f, 0.0f, -60.0f);
+
 	// Setup shapes for control
 	EShapeControl CurrentShapeControl = eCircle;
 
@@ -171,6 +1041,21 @@ int main()
 
 	MyCamera->AttachToParent(ControlCircle.mCentre);
 
+	// Tests the controlled shape against every background shape. Works for any type of controlled shape,
+	// as the test for each pair of shape types is picked at compile time.
+	auto CollideWithBackground = [&](auto& Control)
+		{
+			for (int i = 0; i < NumBackgroundShapes; i++)
+			{
+				CollideAndResolve(Control, BackgroundShapesArray[i]);
+			}
+
+			CollideAndResolve(Control, BackgroundWall);
+			CollideAndResolve(Control, BackgroundAABB);
+			CollideAndResolve(Control, BackgroundOBB);
+			CollideAndResolve(Control, BackgroundCapsule);
+		};
+
 	// The main game loop, repeat until engine is stopped
 	while (myEngine->IsRunning())
 	{
@@ -195,6 +1080,9 @@ int main()
 			{
 				BackgroundShapesArray[i].mCentre->RotateY(RotateSpeed * DeltaTime);
 			}
+			BackgroundWall.mCentre->RotateY(RotateSpeed * DeltaTime);
+			BackgroundOBB.mCentre->RotateY(RotateSpeed * DeltaTime);
+			BackgroundCapsule.mCentre->RotateY(RotateSpeed * DeltaTime);
 		}
 
 		// Get index of current shape
@@ -288,53 +1176,15 @@ int main()
 			}
 		}
 
-		// Data for collision
-		CollisionData ColData;
-		ColData.InitialiseData();
-
 		// Test for collision
 		if (CurrentShapeControl == eCircle)
 		{
-			// Circle to polygon SAT
-			for (int i = 0; i < NumBackgroundShapes; i++)
-			{
-				if (ShapeToCircleSAT(BackgroundShapesArray[i], ControlCircle, ColData))
-				{
-					BackgroundShapesArray[i].mCentre->SetSkin("RedBall.jpg");
-
-					// Resolve collision
-					ControlCircle.mCentre->MoveX(-ColData.mPenetration * ColData.mNormal.x);
-					ControlCircle.mCentre->MoveZ(-ColData.mPenetration * ColData.mNormal.y);
-				}
-				else
-				{
-					BackgroundShapesArray[i].mCentre->SetSkin("Grass1.jpg");
-				}
-
-				ColData.InitialiseData();
-			}
+			CollideWithBackground(ControlCircle);
 		}
 		else
 		{
-			// Polygon to polygon SAT
-			for (int i = 0; i < NumBackgroundShapes; i++)
-			{
-				if (TwoShapesSAT(ControlShapesArray[ShapeIndex - 1], BackgroundShapesArray[i], ColData))
-				{
-					BackgroundShapesArray[i].mCentre->SetSkin("RedBall.jpg");
-
-					// Resolve collision
-					ControlShapesArray[ShapeIndex - 1].mCentre->MoveX(ColData.mPenetration * ColData.mNormal.x);
-					ControlShapesArray[ShapeIndex - 1].mCentre->MoveZ(ColData.mPenetration * ColData.mNormal.y);
-				}
-				else
-				{
-					BackgroundShapesArray[i].mCentre->SetSkin("Grass1.jpg");
-				}
-
-				ColData.InitialiseData();
-			}
-		}
+			CollideWithBackground(ControlShapesArray[ShapeIndex - 1]);
+		}
 
 		// Show instructions text on screen
 		MyFont->Draw("Press SPACE to toggle shapes rotating", 10, 10, Black);
@@ -397,12 +1247,25 @@ float Vector2::DotProduct(const Vector2& OtherVec) const
 	return (x * OtherVec.x + y * OtherVec.y);
 }
 
+// Returns the 2D cross product (the z component of the 3D cross product).
+// Positive if OtherVec is counter-clockwise from the vector.
+float Vector2::CrossProduct(const Vector2& OtherVec) const
+{
+	return (x * OtherVec.y - y * OtherVec.x);
+}
+
 // Returns a vector perpendicular to the current vector (clockwise)
 Vector2 Vector2::PerpendicularVector() const
 {
 	return Vector2(-(this->y), this->x);
 }
 
+// Returns the vector rotated counter-clockwise by the angle with the given cos and sin.
+Vector2 Vector2::Rotate(const float& Cos, const float& Sin) const
+{
+	return Vector2(Cos * x - Sin * y, Sin * x + Cos * y);
+}
+
 // Sets up the square
 void Square::InitialiseSquare(Mesh* DummyMesh, Mesh* CornerMesh, const float Side)
 {
@@ -546,34 +1409,173 @@ void GetMinMaxVertexOnAxisSquare(const Vector2& Axis, const Square& Sq, float& M
 	}
 }
 
+// Creates a regular polygon. SideLength is the distance from the centre to each corner.
 void Polygon::InitialiseShape(Mesh* DummyMesh, Mesh* CornerMesh, const int NumSides, const float SideLength)
 {
-	// Create centre dummy model
-	mCentre = DummyMesh->CreateModel();
-
 	// Calculate how many degrees to turn to each corner
 	const float DegreesToTurn = 360.0f / NumSides;
 	const float RadiansToTurn = DegreesToTurn * DegreesToRadians;
 
-	// Create corners with correct local position to the centre
+	// Corners start at +Z and turn counter-clockwise
+	std::vector<Vector2> LocalPoints;
+	LocalPoints.reserve(NumSides);
 	for (int i = 0; i < NumSides; i++)
 	{
-		// Create corner and attach to centre
-		mVertices.push_back(CornerMesh->CreateModel());
-		mVertices.at(i)->AttachToParent(mCentre);
+		LocalPoints.push_back(Vector2(-SideLength * sin(i * RadiansToTurn), SideLength * cos(i * RadiansToTurn)));
+	}
+
+	InitialiseLocalVertices(DummyMesh, CornerMesh, LocalPoints);
+}
+
+// Creates a convex polygon from any set of points relative to the centre, e.g. the footprint of a mesh.
+// The shape is the convex hull of the points. If Tolerance is above zero, any corner closer than Tolerance
+// to the line between its neighbours is removed, so there are fewer vertices and axes to project in SAT.
+// Returns false, and creates nothing, if there are fewer than 3 points that are not all in a line.
+bool Polygon::InitialiseFromPoints(Mesh* DummyMesh, Mesh* CornerMesh, const std::vector<Vector2>& Points, const float Tolerance)
+{
+	std::vector<Vector2> Hull = ConvexHull(Points);
+
+	if (Tolerance > 0.0f)
+	{
+		SimplifyConvexHull(Hull, Tolerance);
+	}
+
+	return InitialiseLocalVertices(DummyMesh, CornerMesh, Hull);
+}
+
+// Creates the centre and corner models, and precalculates the outward normal of each side.
+// LocalPoints must be a convex polygon in counter-clockwise order.
+// If DummyMesh is nullptr no models are created, and the shape starts at the origin.
+// Returns false, and creates nothing, if the points have fewer than 3 corners, a side of zero length, or no area.
+bool Polygon::InitialiseLocalVertices(Mesh* DummyMesh, Mesh* CornerMesh, const std::vector<Vector2>& LocalPoints)
+{
+	const int NumPoints = static_cast<int>(LocalPoints.size());
+	if (NumPoints < 3)
+	{
+		return false;
+	}
+
+	float DoubleArea = 0.0f;
+	for (int i = 0; i < NumPoints; i++)
+	{
+		const Vector2& Next = LocalPoints.at((i + 1) % NumPoints);
+		if (Next.x == LocalPoints.at(i).x && Next.y == LocalPoints.at(i).y)
+		{
+			return false;
+		}
+		DoubleArea += LocalPoints.at(i).CrossProduct(Next);
+	}
+
+	if (DoubleArea <= 0.0f)
+	{
+		return false;
+	}
+
+	// Create centre dummy model
+	mCentre = (DummyMesh != nullptr) ? DummyMesh->CreateModel() : nullptr;
+	mCentrePosition = { 0.0f, 0.0f };
+
+	const int NumVertices = static_cast<int>(LocalPoints.size());
+	mVertices.reserve(NumVertices);
+	mVerticesPositions.reserve(NumVertices);
+	mAxes.reserve(NumVertices);
+	mLocalVerticesPositions = LocalPoints;
+	mLocalAxes.reserve(NumVertices);
+
+	// Create corners with correct local position to the centre
+	for (int i = 0; i < NumVertices; i++)
+	{
+		if (mCentre != nullptr)
+		{
+			// Create corner and attach to centre
+			mVertices.push_back(CornerMesh->CreateModel());
+			mVertices.at(i)->AttachToParent(mCentre);
+
+			// Change corner's local position
+			mVertices.at(i)->SetLocalX(LocalPoints.at(i).x);
+			mVertices.at(i)->SetLocalZ(LocalPoints.at(i).y);
+
+			// Reserve space in VerticesPositions and Axes vectors.
+			mVerticesPositions.push_back({ mVertices.at(i)->GetX(), mVertices.at(i)->GetZ() });
+		}
+		else
+		{
+			mVerticesPositions.push_back(LocalPoints.at(i));
+		}
+
+		// Outward normal of the side from this corner to the next.
+		// The vertices are counter-clockwise, so the normal is the side turned clockwise.
+		Vector2 Side = LocalPoints.at((i + 1) % NumVertices).Subtract(LocalPoints.at(i));
+		Side.Normalise();
+		mLocalAxes.push_back({ Side.y, -Side.x });
+		mAxes.push_back(mLocalAxes.at(i));
+	}
+
+	Vector2 FirstSide = LocalPoints.at(1).Subtract(LocalPoints.at(0));
+	mInvFirstSideLengthSquared = 1.0f / FirstSide.DotProduct(FirstSide);
+
+	InitialiseLevelsOfDetail();
+	return true;
+}
+
+// Finds the inner and outer circles around the centre and, for polygons with many sides, a coarse hull with fewer sides.
+// The coarse hull is every few sides of the polygon made longer until they meet, so it contains the polygon.
+void Polygon::InitialiseLevelsOfDetail()
+{
+	const int NumVertices = static_cast<int>(mLocalVerticesPositions.size());
+
+	mInnerRadius = FLT_MAX;
+	mOuterRadius = 0.0f;
+	for (int i = 0; i < NumVertices; i++)
+	{
+		mInnerRadius = std::min(mInnerRadius, mLocalVerticesPositions.at(i).DotProduct(mLocalAxes.at(i)));
+		mOuterRadius = std::max(mOuterRadius, mLocalVerticesPositions.at(i).Length());
+	}
+
+	// The centre can be outside a polygon made from points
+	mInnerRadius = std::max(mInnerRadius, 0.0f);
+
+	mLocalCoarseVerticesPositions.clear();
+	mLocalCoarseAxes.clear();
+	if (NumVertices > PolygonCoarseHullMaxSides)
+	{
+		const int SidesPerCoarseSide = (NumVertices + PolygonCoarseHullMaxSides - 1) / PolygonCoarseHullMaxSides;
+		const int NumCoarseSides = NumVertices / SidesPerCoarseSide;
 
-		// Change corner's local position
-		mVertices.at(i)->MoveLocalX(SideLength * sin(i * RadiansToTurn));
-		mVertices.at(i)->MoveLocalZ(SideLength * cos(i * RadiansToTurn));
+		for (int i = 0; i < NumCoarseSides; i++)
+		{
+			const int Side = i * SidesPerCoarseSide;
+			const int PreviousSide = ((i + NumCoarseSides - 1) % NumCoarseSides) * SidesPerCoarseSide;
+			const Vector2& Axis = mLocalAxes.at(Side);
+			const Vector2& PreviousAxis = mLocalAxes.at(PreviousSide);
+
+			// Sides that turn half way round or more don't meet around the polygon, so there is no coarse hull
+			const float Cross = PreviousAxis.CrossProduct(Axis);
+			if (Cross <= 0.0f)
+			{
+				mLocalCoarseVerticesPositions.clear();
+				mLocalCoarseAxes.clear();
+				break;
+			}
 
-		// Reserve space in VerticesPositions and Axes vectors.
-		mVerticesPositions.push_back({ mVertices.at(i)->GetX(), mVertices.at(i)->GetZ() });
-		mAxes.push_back({ 0.0f, 0.0f });
+			// Corner where the line of the previous side meets the line of this side
+			const float Distance = mLocalVerticesPositions.at(Side).DotProduct(Axis);
+			const float PreviousDistance = mLocalVerticesPositions.at(PreviousSide).DotProduct(PreviousAxis);
+			mLocalCoarseVerticesPositions.push_back({ (PreviousDistance * Axis.y - Distance * PreviousAxis.y) / Cross,
+				(PreviousAxis.x * Distance - Axis.x * PreviousDistance) / Cross });
+			mLocalCoarseAxes.push_back(Axis);
+		}
 	}
+
+	mCoarseVerticesPositions = mLocalCoarseVerticesPositions;
+	mCoarseAxes = mLocalCoarseAxes;
+	UpdateCoarseHull(1.0f, 0.0f);
 }
 
 void Polygon::UpdateVerticesPosition()
 {
+	UpdateCentrePos();
+
 	for (int i = 0; i < mVertices.size(); i++)
 	{
 		mVerticesPositions.at(i) = { mVertices.at(i)->GetX(), mVertices.at(i)->GetZ() };
@@ -581,34 +1583,211 @@ void Polygon::UpdateVerticesPosition()
 }
 
 // Axes are the normals to each side of the shape. There will be the same number of axes as vertices.
+// The normals were calculated when the shape was created, so they only need rotating to match the shape.
+// The rotation comes from comparing the first side in world space with the first side in local space.
+// UpdateVerticesPosition must be called first.
 void Polygon::UpdateAxes()
 {
-	for (int i = 0; i < mVertices.size(); i++)
+	// Shapes without models have their axes set by SetTransform
+	if (mCentre == nullptr)
+	{
+		return;
+	}
+
+	const Vector2 LocalSide = mLocalVerticesPositions.at(1).Subtract(mLocalVerticesPositions.at(0));
+	const Vector2 WorldSide = mVerticesPositions.at(1).Subtract(mVerticesPositions.at(0));
+
+	// Both sides are the same length, so dividing by the length squared gives the cos and sin of the angle between them
+	const float Cos = LocalSide.DotProduct(WorldSide) * mInvFirstSideLengthSquared;
+	const float Sin = LocalSide.CrossProduct(WorldSide) * mInvFirstSideLengthSquared;
+
+	for (int i = 0; i < mLocalAxes.size(); i++)
+	{
+		mAxes.at(i) = mLocalAxes.at(i).Rotate(Cos, Sin);
+	}
+
+	UpdateCoarseHull(Cos, Sin);
+}
+
+// Moves the coarse hull to the polygon's centre. Cos and Sin are of the angle to rotate the local coarse hull counter-clockwise.
+void Polygon::UpdateCoarseHull(const float& Cos, const float& Sin)
+{
+	for (int i = 0; i < mLocalCoarseAxes.size(); i++)
+	{
+		mCoarseVerticesPositions[i] = mCentrePosition.Add(mLocalCoarseVerticesPositions[i].Rotate(Cos, Sin));
+		mCoarseAxes[i] = mLocalCoarseAxes[i].Rotate(Cos, Sin);
+	}
+}
+
+// Moves a shape without models. Cos and Sin are of the angle to rotate the local vertices counter-clockwise.
+void Polygon::SetTransform(const Vector2& Position, const float& Cos, const float& Sin)
+{
+	mCentrePosition = Position;
+
+	for (int i = 0; i < mLocalVerticesPositions.size(); i++)
+	{
+		mVerticesPositions[i] = Position.Add(mLocalVerticesPositions[i].Rotate(Cos, Sin));
+		mAxes[i] = mLocalAxes[i].Rotate(Cos, Sin);
+	}
+
+	UpdateCoarseHull(Cos, Sin);
+}
+
+// Returns the convex hull of the points in counter-clockwise order, using Andrew's monotone chain.
+// Points in the middle of a side are not included in the hull.
+// https://en.wikibooks.org/wiki/Algorithm_Implementation/Geometry/Convex_hull/Monotone_chain
+std::vector<Vector2> ConvexHull(std::vector<Vector2> Points)
+{
+	const int NumPoints = static_cast<int>(Points.size());
+	if (NumPoints < 3)
 	{
-		if (i == mVertices.size() - 1)
+		return Points;
+	}
+
+	// Sort points by x, then by y
+	std::sort(Points.begin(), Points.end(), [](const Vector2& A, const Vector2& B)
 		{
-			mAxes.at(i) = mVerticesPositions.at(0).Subtract(mVerticesPositions.at(i));
-		}
-		else
+			return A.x < B.x || (A.x == B.x && A.y < B.y);
+		});
+
+	std::vector<Vector2> Hull(2 * NumPoints);
+	int HullSize = 0;
+
+	// Build lower hull. Remove the last point while it doesn't make a counter-clockwise turn.
+	for (int i = 0; i < NumPoints; i++)
+	{
+		while (HullSize >= 2 && Hull.at(HullSize - 1).Subtract(Hull.at(HullSize - 2)).CrossProduct(Points.at(i).Subtract(Hull.at(HullSize - 2))) <= 0.0f)
 		{
-			mAxes.at(i) = mVerticesPositions.at(i + 1).Subtract(mVerticesPositions.at(i));
+			HullSize--;
 		}
+		Hull.at(HullSize++) = Points.at(i);
+	}
 
-		mAxes.at(i).Normalise();
-		mAxes.at(i) = mAxes.at(i).PerpendicularVector();
+	// Build upper hull
+	const int LowerHullSize = HullSize + 1;
+	for (int i = NumPoints - 2; i >= 0; i--)
+	{
+		while (HullSize >= LowerHullSize && Hull.at(HullSize - 1).Subtract(Hull.at(HullSize - 2)).CrossProduct(Points.at(i).Subtract(Hull.at(HullSize - 2))) <= 0.0f)
+		{
+			HullSize--;
+		}
+		Hull.at(HullSize++) = Points.at(i);
 	}
+
+	// Last point is the same as the first
+	Hull.resize(HullSize - 1);
+	return Hull;
 }
 
+// Removes corners of a convex hull that are nearly in line with their neighbours.
+// Each corner is measured by how far the original hull's points between its neighbours are from the line between them,
+// and the closest is removed first, until every corner is at least Tolerance from that line or only a triangle is left.
+// The hull stays convex, and shrinks by less than Tolerance: no original point ends up further than that from it.
+void SimplifyConvexHull(std::vector<Vector2>& Hull, const float Tolerance)
+{
+	const std::vector<Vector2> Original = Hull;
+	const int NumOriginal = static_cast<int>(Original.size());
+
+	// Index in Original of each remaining corner, in the same order
+	std::vector<int> Kept;
+	for (int i = 0; i < NumOriginal; i++)
+	{
+		Kept.push_back(i);
+	}
+
+	while (Kept.size() > 3)
+	{
+		const int NumVertices = static_cast<int>(Kept.size());
+		float MinDist = Tolerance;
+		int RemoveIndex = -1;
+
+		for (int i = 0; i < NumVertices; i++)
+		{
+			const int Previous = Kept.at((i + NumVertices - 1) % NumVertices);
+			const int Next = Kept.at((i + 1) % NumVertices);
+			const Vector2 Base = Original.at(Next).Subtract(Original.at(Previous));
+			const float BaseLength = Base.Length();
+
+			// Furthest distance of the original points cut off by the line between the neighbours,
+			// which are this corner and any already removed next to it
+			float Dist = 0.0f;
+			for (int j = (Previous + 1) % NumOriginal; j != Next && Dist < MinDist; j = (j + 1) % NumOriginal)
+			{
+				const float PointDist = fabs(Base.CrossProduct(Original.at(j).Subtract(Original.at(Previous)))) / BaseLength;
+				Dist = std::max(Dist, PointDist);
+			}
+
+			if (Dist < MinDist)
+			{
+				MinDist = Dist;
+				RemoveIndex = i;
+			}
+		}
+
+		// All remaining corners are far enough from the line
+		if (RemoveIndex == -1)
+		{
+			break;
+		}
+
+		Kept.erase(Kept.begin() + RemoveIndex);
+	}
+
+	Hull.clear();
+	for (int i = 0; i < Kept.size(); i++)
+	{
+		Hull.push_back(Original.at(Kept.at(i)));
+	}
+}
 
+// Tests the polygons from their coarsest level of detail to the exact polygons, and stops at the first level that can decide.
+// Data.mPolygonLevel is set to the level that decided.
 bool TwoShapesSAT(Polygon& First, Polygon& Second, CollisionData& Data)
 {
-	// Udpate vertices positions of both squares
+	// Udpate vertices positions of both polygons
 	First.UpdateVerticesPosition();
 	Second.UpdateVerticesPosition();
 
-	// Update axes of first square
+	// Update axes of both polygons, which moves their coarse hulls too
 	First.UpdateAxes();
+	Second.UpdateAxes();
+
+	// Outer circles contain the polygons, so if they are apart the polygons are apart along the line between the centres
+	Vector2 SecondToFirst = First.mCentrePosition.Subtract(Second.mCentrePosition);
+	const float DistanceSquared = SecondToFirst.DotProduct(SecondToFirst);
+	const float OuterRadii = First.mOuterRadius + Second.mOuterRadius;
+	if (DistanceSquared > OuterRadii * OuterRadii)
+	{
+		SecondToFirst.Normalise();
+		Data.mSeparatingAxis = SecondToFirst;
+		Data.mPolygonLevel = eLevelOuterCircles;
+		return false;
+	}
+
+	// Inner circles are inside the polygons, so if they overlap the polygons do and the coarse hulls can't separate them.
+	// That only decides that they collide. The depth and normal still come from the exact polygons.
+	const float InnerRadii = First.mInnerRadius + Second.mInnerRadius;
+	if (DistanceSquared < InnerRadii * InnerRadii)
+	{
+		TwoShapesExactSAT(First, Second, Data);
+		Data.mPolygonLevel = eLevelInnerCircles;
+		return true;
+	}
+
+	// Coarse hulls contain the polygons, so an axis the hulls are apart on separates the polygons
+	if ((!First.mCoarseAxes.empty() || !Second.mCoarseAxes.empty()) && CoarseHullsSeparated(First, Second, Data))
+	{
+		Data.mPolygonLevel = eLevelCoarseHulls;
+		return false;
+	}
+
+	Data.mPolygonLevel = eLevelExact;
+	return TwoShapesExactSAT(First, Second, Data);
+}
 
+// Tests the exact polygons on every axis of both. UpdateVerticesPosition and UpdateAxes must be called first.
+bool TwoShapesExactSAT(const Polygon& First, const Polygon& Second, CollisionData& Data)
+{
 	// Check each axis for collision. If any return false then there is no collision.
 	for (int i = 0; i < First.mAxes.size(); i++)
 	{
@@ -618,9 +1797,6 @@ bool TwoShapesSAT(Polygon& First, Polygon& Second, CollisionData& Data)
 		}
 	}
 
-	// Update axes of second square
-	Second.UpdateAxes();
-
 	// Check each axis for collision.
 	for (int i = 0; i < Second.mAxes.size(); i++)
 	{
@@ -654,7 +1830,7 @@ bool CheckCollisionAxisShapes(const Vector2& Axis, const Polygon& First, const P
 		// If they are overlapping, update collision data.
 		Data.UpdateData(Axis, Min1, Max1, Min2, Max2);
 
-		Vector2 NormalDirection(First.mCentre->GetX() - Second.mCentre->GetX(), First.mCentre->GetZ() - Second.mCentre->GetZ());
+		Vector2 NormalDirection = First.mCentrePosition.Subtract(Second.mCentrePosition);
 		if (NormalDirection.DotProduct(Data.mNormal) < 0.0f)
 		{
 			Data.mNormal.Reverse();
@@ -663,30 +1839,56 @@ bool CheckCollisionAxisShapes(const Vector2& Axis, const Polygon& First, const P
 		return true;
 	}
 
+	Data.mSeparatingAxis = Axis;
 	return false;
 }
 
 void GetMinMaxVertexOnAxisShape(const Vector2& Axis, const Polygon& Shape, float& Min, float& Max)
 {
-	// Assume initial min/max
-	Min = Shape.mVerticesPositions.at(0).DotProduct(Axis);
-	Max = Min;
+	GetMinMaxVertexOnAxis(Axis, Shape.mVerticesPositions, Min, Max);
+}
 
-	// Loop through remaining vertices to find min/max
-	for (int i = 1; i < Shape.mVerticesPositions.size(); i++)
-	{
-		float Projection = Shape.mVerticesPositions.at(i).DotProduct(Axis);
+// Returns true if an axis of either coarse hull separates the hulls, and stores that axis in Data.
+// A polygon without a coarse hull is used as it is.
+bool CoarseHullsSeparated(const Polygon& First, const Polygon& Second, CollisionData& Data)
+{
+	const bool bFirstHasHull = !First.mCoarseAxes.empty();
+	const bool bSecondHasHull = !Second.mCoarseAxes.empty();
+	const std::vector<Vector2>& FirstVertices = bFirstHasHull ? First.mCoarseVerticesPositions : First.mVerticesPositions;
+	const std::vector<Vector2>& SecondVertices = bSecondHasHull ? Second.mCoarseVerticesPositions : Second.mVerticesPositions;
+	const std::vector<Vector2>* Axes[2] = { bFirstHasHull ? &First.mCoarseAxes : &First.mAxes, bSecondHasHull ? &Second.mCoarseAxes : &Second.mAxes };
 
-		if (Projection < Min)
+	for (int Hull = 0; Hull < 2; Hull++)
+	{
+		for (int i = 0; i < Axes[Hull]->size(); i++)
 		{
-			Min = Projection;
-		}
+			const Vector2& Axis = Axes[Hull]->at(i);
+			float Min1, Max1, Min2, Max2;
+			GetMinMaxVertexOnAxis(Axis, FirstVertices, Min1, Max1);
+			GetMinMaxVertexOnAxis(Axis, SecondVertices, Min2, Max2);
 
-		if (Projection > Max)
-		{
-			Max = Projection;
+			if (Max1 < Min2 || Max2 < Min1)
+			{
+				Data.mSeparatingAxis = Axis;
+				return true;
+			}
 		}
 	}
+
+	return false;
+}
+
+void GetMinMaxVertexOnAxis(const Vector2& Axis, const std::vector<Vector2>& Vertices, float& Min, float& Max)
+{
+	Min = Vertices.at(0).DotProduct(Axis);
+	Max = Min;
+
+	for (int i = 1; i < Vertices.size(); i++)
+	{
+		const float Projection = Vertices.at(i).DotProduct(Axis);
+		Min = std::min(Min, Projection);
+		Max = std::max(Max, Projection);
+	}
 }
 
 // Determines if a Shape and a Circle are colliding. Returns true if they are.
@@ -711,11 +1913,11 @@ bool ShapeToCircleSAT(Polygon& FirstPolygon, Circle& SecondCircle, CollisionData
 		}
 	}
 
-	// Update axis of circle
-	SecondCircle.UpdateAxis(FirstPolygon);
+	// Find axis of circle. It isn't stored in the circle, so shapes are only read and can be tested on several threads at once.
+	const Vector2 CircleAxis = SecondCircle.GetAxis(FirstPolygon);
 
 	// Check axis for collision
-	if (!CheckCollisionAxisShapeCircle(SecondCircle.mAxis, FirstPolygon, SecondCircle, Data))
+	if (!CheckCollisionAxisShapeCircle(CircleAxis, FirstPolygon, SecondCircle, Data))
 	{
 		return false;
 	}
@@ -729,6 +1931,8 @@ void CollisionData::InitialiseData()
 {
 	mPenetration = FLT_MAX; // Initialise to a large number so we find correct minimum
 	mNormal = { 0.0f, 0.0f };
+	mSeparatingAxis = { 0.0f, 0.0f };
+	mPolygonLevel = eLevelNone;
 }
 
 // Checks if the new penetration is smaller than the current penetration. If it is, new penetration replaces current penetration.
@@ -749,24 +1953,23 @@ void CollisionData::UpdateData(const Vector2& Axis, const float& Min1, const flo
 	}
 }
 
-// Creates circle model with passed in mesh. Changes radius to passed in value.
+// Creates circle model with passed in mesh (no model if nullptr). Changes radius to passed in value.
 // Initialises centre position to (0.0f, 0.0f)
 void Circle::InitialiseCircle(Mesh* CentreMesh, const float Radius)
 {
-	mCentre = CentreMesh->CreateModel();
+	mCentre = (CentreMesh != nullptr) ? CentreMesh->CreateModel() : nullptr;
 	mRadius = Radius;
 	mCentrePosition = { 0.0f, 0.0f };
 }
 
-// Updates CentrePosition with current world position.
-void Circle::UpdateCentrePos()
+// Moves a circle without a model. Rotation makes no difference to a circle.
+void Circle::SetTransform(const Vector2& Position, const float&, const float&)
 {
-	mCentrePosition.x = mCentre->GetX();
-	mCentrePosition.y = mCentre->GetZ();
+	mCentrePosition = Position;
 }
 
 // Axis to use for a circle is from the centre of the circle to the closest point on the polygon.
-void Circle::UpdateAxis(Polygon& Poly)
+Vector2 Circle::GetAxis(const Polygon& Poly) const
 {
 	float MinDist = FLT_MAX;
 	int ClosestIndex = -1;
@@ -782,8 +1985,9 @@ void Circle::UpdateAxis(Polygon& Poly)
 		}
 	}
 
-	mAxis = Poly.mVerticesPositions.at(ClosestIndex).Subtract(mCentrePosition);
-	mAxis.Normalise();
+	Vector2 Axis = Poly.mVerticesPositions.at(ClosestIndex).Subtract(mCentrePosition);
+	Axis.Normalise();
+	return Axis;
 }
 
 // Using this video for outline of implementation https://youtu.be/vWs33LVrs74?si=OyFbAbT5qoq8Um0w
@@ -806,7 +2010,7 @@ bool CheckCollisionAxisShapeCircle(const Vector2& Axis, const Polygon& Poly, con
 		// The normal points from the circle to the shape.
 		Data.UpdateData(Axis, Min1, Max1, Min2, Max2);
 
-		Vector2 NormalDirection(Poly.mCentre->GetX() - Circ.mCentre->GetX(), Poly.mCentre->GetZ() - Circ.mCentre->GetZ());
+		Vector2 NormalDirection = Poly.mCentrePosition.Subtract(Circ.mCentrePosition);
 		if (NormalDirection.DotProduct(Data.mNormal) < 0.0f)
 		{
 			Data.mNormal.Reverse();
@@ -815,6 +2019,7 @@ bool CheckCollisionAxisShapeCircle(const Vector2& Axis, const Polygon& Poly, con
 		return true;
 	}
 
+	Data.mSeparatingAxis = Axis;
 	return false;
 }
 
@@ -847,3 +2052,3592 @@ void Shape::MoveToPos(const Vector2& NewPos)
 	mCentre->SetX(NewPos.x);
 	mCentre->SetZ(NewPos.y);
 }
+
+// Updates CentrePosition with current world position. Shapes without models keep the position from SetTransform.
+void Shape::UpdateCentrePos()
+{
+	if (mCentre == nullptr)
+	{
+		return;
+	}
+
+	mCentrePosition.x = mCentre->GetX();
+	mCentrePosition.y = mCentre->GetZ();
+}
+
+// Returns true if the boxes overlap (touching counts as overlapping).
+// All four comparisons are made without branching, as which one fails first is hard to predict.
+bool BoundingBox::Overlaps(const BoundingBox& OtherBox) const
+{
+	return (mMin.x <= OtherBox.mMax.x) & (mMax.x >= OtherBox.mMin.x) & (mMin.y <= OtherBox.mMax.y) & (mMax.y >= OtherBox.mMin.y);
+}
+
+// Returns the smallest box containing both boxes.
+BoundingBox BoundingBox::Merge(const BoundingBox& OtherBox) const
+{
+	BoundingBox Merged;
+	Merged.mMin = { std::min(mMin.x, OtherBox.mMin.x), std::min(mMin.y, OtherBox.mMin.y) };
+	Merged.mMax = { std::max(mMax.x, OtherBox.mMax.x), std::max(mMax.y, OtherBox.mMax.y) };
+	return Merged;
+}
+
+Vector2 BoundingBox::GetCentre() const
+{
+	return mMin.Add(mMax).MultiplyScalar(0.5f);
+}
+
+// Box around the world positions of the vertices. UpdateVerticesPosition must be called first.
+BoundingBox Polygon::GetBoundingBox() const
+{
+	BoundingBox Box = { mVerticesPositions.at(0), mVerticesPositions.at(0) };
+
+	for (int i = 1; i < mVerticesPositions.size(); i++)
+	{
+		Box.mMin = { std::min(Box.mMin.x, mVerticesPositions.at(i).x), std::min(Box.mMin.y, mVerticesPositions.at(i).y) };
+		Box.mMax = { std::max(Box.mMax.x, mVerticesPositions.at(i).x), std::max(Box.mMax.y, mVerticesPositions.at(i).y) };
+	}
+
+	return Box;
+}
+
+// Box around the circle. UpdateCentrePos must be called first.
+BoundingBox Circle::GetBoundingBox() const
+{
+	BoundingBox Box;
+	Box.mMin = { mCentrePosition.x - mRadius, mCentrePosition.y - mRadius };
+	Box.mMax = { mCentrePosition.x + mRadius, mCentrePosition.y + mRadius };
+	return Box;
+}
+
+// Determines if two Circles are colliding. Returns true if they are.
+// Only the axis between the two centres needs checking.
+// Collision Data is updated with the normal pointing from the Second circle to the First.
+bool TwoCirclesSAT(Circle& First, Circle& Second, CollisionData& Data)
+{
+	First.UpdateCentrePos();
+	Second.UpdateCentrePos();
+
+	Vector2 Between = First.mCentrePosition.Subtract(Second.mCentrePosition);
+	const float Distance = Between.Length();
+	const float RadiusSum = First.mRadius + Second.mRadius;
+
+	if (Distance > RadiusSum)
+	{
+		Data.mSeparatingAxis = Between.MultiplyScalar(1.0f / Distance);
+		return false;
+	}
+
+	// Circles at the same position can be pushed apart in any direction
+	if (Distance == 0.0f)
+	{
+		Between = { 0.0f, 1.0f };
+	}
+	else
+	{
+		Between = Between.MultiplyScalar(1.0f / Distance);
+	}
+
+	Data.UpdateData(Between, RadiusSum - Distance);
+	return true;
+}
+
+// Returns whether segment AB crosses or touches segment CD
+bool SegmentsTouch(const Vector2& A, const Vector2& B, const Vector2& C, const Vector2& D)
+{
+	const float SideC = B.Subtract(A).CrossProduct(C.Subtract(A));
+	const float SideD = B.Subtract(A).CrossProduct(D.Subtract(A));
+	const float SideA = D.Subtract(C).CrossProduct(A.Subtract(C));
+	const float SideB = D.Subtract(C).CrossProduct(B.Subtract(C));
+
+	if (SideC * SideD < 0.0f && SideA * SideB < 0.0f)
+	{
+		return true;
+	}
+
+	// An end on the other segment's line only touches if it is within the other segment
+	auto IsWithin = [](const Vector2& Point, const Vector2& Start, const Vector2& End)
+	{
+		return std::min(Start.x, End.x) <= Point.x && Point.x <= std::max(Start.x, End.x) &&
+			std::min(Start.y, End.y) <= Point.y && Point.y <= std::max(Start.y, End.y);
+	};
+
+	return (SideC == 0.0f && IsWithin(C, A, B)) || (SideD == 0.0f && IsWithin(D, A, B)) ||
+		(SideA == 0.0f && IsWithin(A, C, D)) || (SideB == 0.0f && IsWithin(B, C, D));
+}
+
+// Splits a simple (not self intersecting) outline into convex pieces, in either winding order.
+// The outline is triangulated by ear clipping, then neighbouring pieces are merged while the result stays convex
+// (Hertel-Mehlhorn), which gives at most 4 times the minimum number of pieces.
+// Pieces are returned counter-clockwise. This is slow, so should only be done when loading.
+// Returns no pieces if the outline can't be split, e.g. because it has fewer than 3 points or is self intersecting.
+// https://www.geometrictools.com/Documentation/TriangulationByEarClipping.pdf
+std::vector<std::vector<Vector2>> ConvexDecomposition(const std::vector<Vector2>& Outline)
+{
+	std::vector<Vector2> Points = Outline;
+	const int NumPoints = static_cast<int>(Points.size());
+	if (NumPoints < 3)
+	{
+		return {};
+	}
+
+	// Make the outline counter-clockwise (positive area)
+	float DoubleArea = 0.0f;
+	for (int i = 0; i < NumPoints; i++)
+	{
+		DoubleArea += Points.at(i).CrossProduct(Points.at((i + 1) % NumPoints));
+	}
+
+	if (DoubleArea < 0.0f)
+	{
+		std::reverse(Points.begin(), Points.end());
+	}
+
+	// Ear clipping doesn't notice every self intersecting outline, so check that no two sides that aren't neighbours touch
+	for (int i = 0; i < NumPoints; i++)
+	{
+		const Vector2& A = Points.at(i);
+		const Vector2& B = Points.at((i + 1) % NumPoints);
+
+		for (int j = i + 2; j < NumPoints; j++)
+		{
+			if (i == 0 && j == NumPoints - 1)
+			{
+				continue;
+			}
+
+			if (SegmentsTouch(A, B, Points.at(j), Points.at((j + 1) % NumPoints)))
+			{
+				return {};
+			}
+		}
+	}
+
+	// Ear clipping. Each piece is a list of indices into Points.
+	std::vector<std::vector<int>> Pieces;
+	std::vector<int> Remaining;
+	for (int i = 0; i < NumPoints; i++)
+	{
+		Remaining.push_back(i);
+	}
+
+	while (Remaining.size() > 3)
+	{
+		const int NumRemaining = static_cast<int>(Remaining.size());
+		bool bFoundEar = false;
+
+		for (int i = 0; i < NumRemaining && !bFoundEar; i++)
+		{
+			const int Previous = Remaining.at((i + NumRemaining - 1) % NumRemaining);
+			const int Current = Remaining.at(i);
+			const int Next = Remaining.at((i + 1) % NumRemaining);
+
+			const Vector2& A = Points.at(Previous);
+			const Vector2& B = Points.at(Current);
+			const Vector2& C = Points.at(Next);
+
+			const float Turn = B.Subtract(A).CrossProduct(C.Subtract(B));
+
+			// Corners in a straight line don't change the shape, so can be removed
+			if (Turn == 0.0f)
+			{
+				Remaining.erase(Remaining.begin() + i);
+				bFoundEar = true;
+				continue;
+			}
+
+			// Reflex corner, can't be an ear
+			if (Turn < 0.0f)
+			{
+				continue;
+			}
+
+			// It is only an ear if no other corner is inside the triangle
+			bool bIsEar = true;
+			for (int j = 0; j < NumRemaining && bIsEar; j++)
+			{
+				const int Other = Remaining.at(j);
+				if (Other == Previous || Other == Current || Other == Next)
+				{
+					continue;
+				}
+
+				const Vector2& P = Points.at(Other);
+				if (B.Subtract(A).CrossProduct(P.Subtract(A)) >= 0.0f &&
+					C.Subtract(B).CrossProduct(P.Subtract(B)) >= 0.0f &&
+					A.Subtract(C).CrossProduct(P.Subtract(C)) >= 0.0f)
+				{
+					bIsEar = false;
+				}
+			}
+
+			if (bIsEar)
+			{
+				Pieces.push_back({ Previous, Current, Next });
+				Remaining.erase(Remaining.begin() + i);
+				bFoundEar = true;
+			}
+		}
+
+		// Shouldn't happen for a simple outline, but the pieces found so far would be missing some of it, so there are none
+		if (!bFoundEar)
+		{
+			return {};
+		}
+	}
+
+	if (Remaining.size() == 3)
+	{
+		Pieces.push_back(Remaining);
+	}
+
+	// Merge pieces that share a side while the merged piece is still convex
+	bool bMerged = true;
+	while (bMerged)
+	{
+		bMerged = false;
+
+		for (int i = 0; i < Pieces.size() && !bMerged; i++)
+		{
+			for (int j = i + 1; j < Pieces.size() && !bMerged; j++)
+			{
+				const std::vector<int>& First = Pieces.at(i);
+				const std::vector<int>& Second = Pieces.at(j);
+				const int FirstSize = static_cast<int>(First.size());
+				const int SecondSize = static_cast<int>(Second.size());
+
+				// Find side A->B in the first piece that is B->A in the second
+				for (int k = 0; k < FirstSize && !bMerged; k++)
+				{
+					const int A = First.at(k);
+					const int B = First.at((k + 1) % FirstSize);
+
+					for (int m = 0; m < SecondSize && !bMerged; m++)
+					{
+						if (Second.at(m) != B || Second.at((m + 1) % SecondSize) != A)
+						{
+							continue;
+						}
+
+						// Go round the first piece from B to A, then round the second piece from after A to before B
+						std::vector<int> Merged;
+						for (int n = 1; n <= FirstSize; n++)
+						{
+							Merged.push_back(First.at((k + n) % FirstSize));
+						}
+						for (int n = 2; n < SecondSize; n++)
+						{
+							Merged.push_back(Second.at((m + n) % SecondSize));
+						}
+
+						// Check every corner of the merged piece turns counter-clockwise
+						bool bIsConvex = true;
+						const int MergedSize = static_cast<int>(Merged.size());
+						for (int n = 0; n < MergedSize && bIsConvex; n++)
+						{
+							const Vector2& P0 = Points.at(Merged.at(n));
+							const Vector2& P1 = Points.at(Merged.at((n + 1) % MergedSize));
+							const Vector2& P2 = Points.at(Merged.at((n + 2) % MergedSize));
+
+							if (P1.Subtract(P0).CrossProduct(P2.Subtract(P1)) < 0.0f)
+							{
+								bIsConvex = false;
+							}
+						}
+
+						if (bIsConvex)
+						{
+							Pieces.at(i) = Merged;
+							Pieces.erase(Pieces.begin() + j);
+							bMerged = true;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// Convert to points. The convex hull removes any corners left in a straight line.
+	std::vector<std::vector<Vector2>> ConvexPieces;
+	for (int i = 0; i < Pieces.size(); i++)
+	{
+		std::vector<Vector2> PiecePoints;
+		for (int j = 0; j < Pieces.at(i).size(); j++)
+		{
+			PiecePoints.push_back(Points.at(Pieces.at(i).at(j)));
+		}
+		ConvexPieces.push_back(ConvexHull(PiecePoints));
+	}
+
+	return ConvexPieces;
+}
+
+// Returns the convex pieces of the outline, only splitting it the first time the outline is seen.
+// Returns nullptr if the outline can't be split, which isn't cached. The returned pointer is only valid until the next call.
+const std::vector<std::vector<Vector2>>* ConvexDecompositionCache::GetPieces(const std::vector<Vector2>& Outline)
+{
+	// Hash the outline so most entries can be skipped without comparing every point
+	size_t Hash = Outline.size();
+	for (int i = 0; i < Outline.size(); i++)
+	{
+		Hash ^= std::hash<float>{}(Outline.at(i).x) + 0x9e3779b9 + (Hash << 6) + (Hash >> 2);
+		Hash ^= std::hash<float>{}(Outline.at(i).y) + 0x9e3779b9 + (Hash << 6) + (Hash >> 2);
+	}
+
+	for (int i = 0; i < mEntries.size(); i++)
+	{
+		const CachedDecomposition& Entry = mEntries.at(i);
+		if (Entry.mHash != Hash || Entry.mOutline.size() != Outline.size())
+		{
+			continue;
+		}
+
+		bool bSameOutline = true;
+		for (int j = 0; j < Outline.size() && bSameOutline; j++)
+		{
+			bSameOutline = (Entry.mOutline.at(j).x == Outline.at(j).x && Entry.mOutline.at(j).y == Outline.at(j).y);
+		}
+
+		if (bSameOutline)
+		{
+			return &Entry.mPieces;
+		}
+	}
+
+	std::vector<std::vector<Vector2>> Pieces = ConvexDecomposition(Outline);
+	if (Pieces.empty())
+	{
+		return nullptr;
+	}
+
+	mEntries.push_back({ Hash, Outline, std::move(Pieces) });
+	return &mEntries.back().mPieces;
+}
+
+// Keeps the smaller of the current penetration and Depth, with its axis.
+// Used by tests that find the penetration directly rather than from min/max projections.
+void CollisionData::UpdateData(const Vector2& Axis, const float& Depth)
+{
+	if (Depth < mPenetration)
+	{
+		mPenetration = Depth;
+		mNormal = Axis;
+	}
+}
+
+// Reverses the normal if it doesn't point the same way as SecondToFirst (e.g. from the second shape's centre to the first's).
+void CollisionData::OrientNormal(const Vector2& SecondToFirst)
+{
+	if (SecondToFirst.DotProduct(mNormal) < 0.0f)
+	{
+		mNormal.Reverse();
+	}
+}
+
+// Creates the centre and corner models (none if DummyMesh is nullptr). HalfSize is half the width (X) and depth (Z) of the box.
+void AABB::InitialiseAABB(Mesh* DummyMesh, Mesh* CornerMesh, const Vector2& HalfSize)
+{
+	mCentre = (DummyMesh != nullptr) ? DummyMesh->CreateModel() : nullptr;
+	mHalfSize = HalfSize;
+	mCentrePosition = { 0.0f, 0.0f };
+
+	if (mCentre == nullptr)
+	{
+		return;
+	}
+
+	// Corners in the same order as Square: 0-+, 1++, 2+-, 3--
+	const float CornerSigns[SquareNumCorners][2] = { { -1.0f, 1.0f }, { 1.0f, 1.0f }, { 1.0f, -1.0f }, { -1.0f, -1.0f } };
+	for (int i = 0; i < SquareNumCorners; i++)
+	{
+		mCorners[i] = CornerMesh->CreateModel();
+		mCorners[i]->AttachToParent(mCentre);
+		mCorners[i]->SetLocalX(CornerSigns[i][0] * HalfSize.x);
+		mCorners[i]->SetLocalZ(CornerSigns[i][1] * HalfSize.y);
+	}
+}
+
+// Moves a box without models. The box stays axis aligned whatever the rotation.
+void AABB::SetTransform(const Vector2& Position, const float&, const float&)
+{
+	mCentrePosition = Position;
+}
+
+BoundingBox AABB::GetBoundingBox() const
+{
+	return { mCentrePosition.Subtract(mHalfSize), mCentrePosition.Add(mHalfSize) };
+}
+
+// Creates the centre and corner models (none if DummyMesh is nullptr). HalfSize is half the width (local X) and depth (local Z) of the box.
+void OBB::InitialiseOBB(Mesh* DummyMesh, Mesh* CornerMesh, const Vector2& HalfSize)
+{
+	mCentre = (DummyMesh != nullptr) ? DummyMesh->CreateModel() : nullptr;
+	mHalfSize = HalfSize;
+	mCentrePosition = { 0.0f, 0.0f };
+	mAxes[0] = { 1.0f, 0.0f };
+	mAxes[1] = { 0.0f, 1.0f };
+
+	if (mCentre == nullptr)
+	{
+		return;
+	}
+
+	const float CornerSigns[SquareNumCorners][2] = { { -1.0f, 1.0f }, { 1.0f, 1.0f }, { 1.0f, -1.0f }, { -1.0f, -1.0f } };
+	for (int i = 0; i < SquareNumCorners; i++)
+	{
+		mCorners[i] = CornerMesh->CreateModel();
+		mCorners[i]->AttachToParent(mCentre);
+		mCorners[i]->SetLocalX(CornerSigns[i][0] * HalfSize.x);
+		mCorners[i]->SetLocalZ(CornerSigns[i][1] * HalfSize.y);
+	}
+}
+
+// Updates the centre position and the box's local X and Z directions in world space.
+// Local X is the top side (corner 0 to corner 1), and local Z is perpendicular to it.
+void OBB::UpdateAxes()
+{
+	// Boxes without models have their axes set by SetTransform
+	if (mCentre == nullptr)
+	{
+		return;
+	}
+
+	UpdateCentrePos();
+
+	const Vector2 TopLeft = { mCorners[0]->GetX(), mCorners[0]->GetZ() };
+	const Vector2 TopRight = { mCorners[1]->GetX(), mCorners[1]->GetZ() };
+
+	mAxes[0] = TopRight.Subtract(TopLeft).MultiplyScalar(0.5f / mHalfSize.x);
+	mAxes[1] = mAxes[0].PerpendicularVector();
+}
+
+// Moves a box without models. Cos and Sin are of the angle to rotate the box counter-clockwise.
+void OBB::SetTransform(const Vector2& Position, const float& Cos, const float& Sin)
+{
+	mCentrePosition = Position;
+	mAxes[0] = { Cos, Sin };
+	mAxes[1] = mAxes[0].PerpendicularVector();
+}
+
+// World positions of the corners, counter-clockwise. UpdateAxes must be called first.
+void OBB::GetCornersPositions(Vector2 Corners[SquareNumCorners]) const
+{
+	const Vector2 HalfX = mAxes[0].MultiplyScalar(mHalfSize.x);
+	const Vector2 HalfZ = mAxes[1].MultiplyScalar(mHalfSize.y);
+
+	Corners[0] = mCentrePosition.Subtract(HalfX).Subtract(HalfZ);
+	Corners[1] = mCentrePosition.Add(HalfX).Subtract(HalfZ);
+	Corners[2] = mCentrePosition.Add(HalfX).Add(HalfZ);
+	Corners[3] = mCentrePosition.Subtract(HalfX).Add(HalfZ);
+}
+
+// UpdateAxes must be called first.
+BoundingBox OBB::GetBoundingBox() const
+{
+	const Vector2 Extent = Vector2(fabs(mAxes[0].x) * mHalfSize.x + fabs(mAxes[1].x) * mHalfSize.y,
+		fabs(mAxes[0].y) * mHalfSize.x + fabs(mAxes[1].y) * mHalfSize.y);
+	return { mCentrePosition.Subtract(Extent), mCentrePosition.Add(Extent) };
+}
+
+// Creates the centre model, and a model at each end of the line (none if DummyMesh is nullptr). The line is along local X.
+void Capsule::InitialiseCapsule(Mesh* DummyMesh, Mesh* EndMesh, const float HalfLength, const float Radius)
+{
+	mCentre = (DummyMesh != nullptr) ? DummyMesh->CreateModel() : nullptr;
+	mHalfLength = HalfLength;
+	mRadius = Radius;
+	mCentrePosition = { 0.0f, 0.0f };
+	mEndsPositions[0] = { -HalfLength, 0.0f };
+	mEndsPositions[1] = { HalfLength, 0.0f };
+
+	if (mCentre == nullptr)
+	{
+		return;
+	}
+
+	for (int i = 0; i < 2; i++)
+	{
+		mEnds[i] = EndMesh->CreateModel();
+		mEnds[i]->AttachToParent(mCentre);
+		mEnds[i]->SetLocalX(i == 0 ? -HalfLength : HalfLength);
+		mEndsPositions[i] = { mEnds[i]->GetX(), mEnds[i]->GetZ() };
+	}
+}
+
+void Capsule::UpdateEndsPosition()
+{
+	// Capsules without models have their ends set by SetTransform
+	if (mCentre == nullptr)
+	{
+		return;
+	}
+
+	UpdateCentrePos();
+
+	for (int i = 0; i < 2; i++)
+	{
+		mEndsPositions[i] = { mEnds[i]->GetX(), mEnds[i]->GetZ() };
+	}
+}
+
+// Moves a capsule without models. Cos and Sin are of the angle to rotate the line counter-clockwise.
+void Capsule::SetTransform(const Vector2& Position, const float& Cos, const float& Sin)
+{
+	const Vector2 HalfLine = { Cos * mHalfLength, Sin * mHalfLength };
+
+	mCentrePosition = Position;
+	mEndsPositions[0] = Position.Subtract(HalfLine);
+	mEndsPositions[1] = Position.Add(HalfLine);
+}
+
+// UpdateEndsPosition must be called first.
+BoundingBox Capsule::GetBoundingBox() const
+{
+	BoundingBox Box;
+	Box.mMin = { std::min(mEndsPositions[0].x, mEndsPositions[1].x) - mRadius, std::min(mEndsPositions[0].y, mEndsPositions[1].y) - mRadius };
+	Box.mMax = { std::max(mEndsPositions[0].x, mEndsPositions[1].x) + mRadius, std::max(mEndsPositions[0].y, mEndsPositions[1].y) + mRadius };
+	return Box;
+}
+
+// Overlap test on one axis, like CheckCollisionAxisShapes but with the projections already found.
+// Updates Data if they overlap. The normal direction is not fixed here, so OrientNormal must be called after the last axis.
+bool CheckOverlapOnAxis(const Vector2& Axis, const float& Min1, const float& Max1, const float& Min2, const float& Max2, CollisionData& Data)
+{
+	if ((Min1 <= Min2 && Max1 >= Min2) || (Min2 <= Min1 && Max2 >= Min1))
+	{
+		Data.UpdateData(Axis, Min1, Max1, Min2, Max2);
+		return true;
+	}
+
+	Data.mSeparatingAxis = Axis;
+	return false;
+}
+
+// Projects a box onto an axis without going through its corners.
+// The half size along the axis is the sum of each half side projected onto the axis.
+void GetMinMaxOnAxisBox(const Vector2& Axis, const Vector2& Centre, const Vector2 BoxAxes[SquareNumAxesToCheck], const Vector2& HalfSize, float& Min, float& Max)
+{
+	const float CentreProjection = Centre.DotProduct(Axis);
+	const float Extent = HalfSize.x * fabs(BoxAxes[0].DotProduct(Axis)) + HalfSize.y * fabs(BoxAxes[1].DotProduct(Axis));
+
+	Min = CentreProjection - Extent;
+	Max = CentreProjection + Extent;
+}
+
+// Projects the capsule's line onto the axis, then adds the radius each side.
+void GetMinMaxOnAxisCapsule(const Vector2& Axis, const Capsule& Cap, float& Min, float& Max)
+{
+	Min = Cap.mEndsPositions[0].DotProduct(Axis);
+	Max = Cap.mEndsPositions[1].DotProduct(Axis);
+
+	if (Min > Max)
+	{
+		std::swap(Min, Max);
+	}
+
+	Min -= Cap.mRadius;
+	Max += Cap.mRadius;
+}
+
+// Returns the closest point to Point on the line from Start to End.
+Vector2 ClosestPointOnSegment(const Vector2& Point, const Vector2& Start, const Vector2& End)
+{
+	const Vector2 Line = End.Subtract(Start);
+	const float LengthSquared = Line.DotProduct(Line);
+
+	if (LengthSquared == 0.0f)
+	{
+		return Start;
+	}
+
+	const float T = std::clamp(Point.Subtract(Start).DotProduct(Line) / LengthSquared, 0.0f, 1.0f);
+	return Start.Add(Line.MultiplyScalar(T));
+}
+
+// Finds the closest points between the line P1-Q1 and the line P2-Q2.
+// From Real-Time Collision Detection (Ericson), section 5.1.9.
+void ClosestPointsBetweenSegments(const Vector2& P1, const Vector2& Q1, const Vector2& P2, const Vector2& Q2, Vector2& Closest1, Vector2& Closest2)
+{
+	const Vector2 D1 = Q1.Subtract(P1);
+	const Vector2 D2 = Q2.Subtract(P2);
+	const Vector2 R = P1.Subtract(P2);
+	const float A = D1.DotProduct(D1);
+	const float E = D2.DotProduct(D2);
+	const float F = D2.DotProduct(R);
+
+	float S = 0.0f;
+	float T = 0.0f;
+
+	if (A == 0.0f && E == 0.0f)
+	{
+		// Both lines are points
+	}
+	else if (A == 0.0f)
+	{
+		T = std::clamp(F / E, 0.0f, 1.0f);
+	}
+	else
+	{
+		const float C = D1.DotProduct(R);
+
+		if (E == 0.0f)
+		{
+			S = std::clamp(-C / A, 0.0f, 1.0f);
+		}
+		else
+		{
+			const float B = D1.DotProduct(D2);
+			const float Denominator = A * E - B * B;
+
+			// Parallel lines can use any S
+			if (Denominator != 0.0f)
+			{
+				S = std::clamp((B * F - C * E) / Denominator, 0.0f, 1.0f);
+			}
+
+			T = (B * S + F) / E;
+
+			if (T < 0.0f)
+			{
+				T = 0.0f;
+				S = std::clamp(-C / A, 0.0f, 1.0f);
+			}
+			else if (T > 1.0f)
+			{
+				T = 1.0f;
+				S = std::clamp((B - C) / A, 0.0f, 1.0f);
+			}
+		}
+	}
+
+	Closest1 = P1.Add(D1.MultiplyScalar(S));
+	Closest2 = P2.Add(D2.MultiplyScalar(T));
+}
+
+// SAT between two boxes, using each box's 2 axes and projecting the boxes directly.
+// The normal points from the second box to the first.
+bool BoxesSAT(const Vector2& Centre1, const Vector2 Axes1[SquareNumAxesToCheck], const Vector2& HalfSize1,
+	const Vector2& Centre2, const Vector2 Axes2[SquareNumAxesToCheck], const Vector2& HalfSize2, CollisionData& Data)
+{
+	float Min1, Max1, Min2, Max2;
+
+	for (int i = 0; i < SquareNumAxesToCheck; i++)
+	{
+		GetMinMaxOnAxisBox(Axes1[i], Centre1, Axes1, HalfSize1, Min1, Max1);
+		GetMinMaxOnAxisBox(Axes1[i], Centre2, Axes2, HalfSize2, Min2, Max2);
+
+		if (!CheckOverlapOnAxis(Axes1[i], Min1, Max1, Min2, Max2, Data))
+		{
+			return false;
+		}
+	}
+
+	for (int i = 0; i < SquareNumAxesToCheck; i++)
+	{
+		GetMinMaxOnAxisBox(Axes2[i], Centre1, Axes1, HalfSize1, Min1, Max1);
+		GetMinMaxOnAxisBox(Axes2[i], Centre2, Axes2, HalfSize2, Min2, Max2);
+
+		if (!CheckOverlapOnAxis(Axes2[i], Min1, Max1, Min2, Max2, Data))
+		{
+			return false;
+		}
+	}
+
+	Data.OrientNormal(Centre1.Subtract(Centre2));
+	return true;
+}
+
+// Box against circle using the closest point on the box to the circle's centre.
+// If the centre is inside the box, the circle is pushed out through the nearest side.
+// The normal points from the circle to the box.
+bool BoxToCircleSAT(const Vector2& Centre, const Vector2 Axes[SquareNumAxesToCheck], const Vector2& HalfSize, Circle& Circ, CollisionData& Data)
+{
+	// Circle centre in the box's space
+	const Vector2 Offset = Circ.mCentrePosition.Subtract(Centre);
+	const float LocalX = Offset.DotProduct(Axes[0]);
+	const float LocalZ = Offset.DotProduct(Axes[1]);
+
+	const float ClampedX = std::clamp(LocalX, -HalfSize.x, HalfSize.x);
+	const float ClampedZ = std::clamp(LocalZ, -HalfSize.y, HalfSize.y);
+
+	// Centre is outside the box
+	if (ClampedX != LocalX || ClampedZ != LocalZ)
+	{
+		const Vector2 Closest = Centre.Add(Axes[0].MultiplyScalar(ClampedX)).Add(Axes[1].MultiplyScalar(ClampedZ));
+		Vector2 CircleToBox = Closest.Subtract(Circ.mCentrePosition);
+		const float Distance = CircleToBox.Length();
+
+		if (Distance > Circ.mRadius)
+		{
+			Data.mSeparatingAxis = CircleToBox.MultiplyScalar(1.0f / Distance);
+			return false;
+		}
+
+		Data.UpdateData(CircleToBox.MultiplyScalar(1.0f / Distance), Circ.mRadius - Distance);
+		return true;
+	}
+
+	// Centre is inside the box, push out through the closest side
+	const float DepthX = HalfSize.x - fabs(LocalX);
+	const float DepthZ = HalfSize.y - fabs(LocalZ);
+
+	if (DepthX < DepthZ)
+	{
+		Data.UpdateData(Axes[0].MultiplyScalar(LocalX < 0.0f ? 1.0f : -1.0f), Circ.mRadius + DepthX);
+	}
+	else
+	{
+		Data.UpdateData(Axes[1].MultiplyScalar(LocalZ < 0.0f ? 1.0f : -1.0f), Circ.mRadius + DepthZ);
+	}
+
+	return true;
+}
+
+// SAT between a convex shape (given by its world vertices and axes) and a capsule.
+// As well as the shape's axes, the capsule's normal is checked, and the axis from each end of the capsule
+// to the closest vertex, which covers the round ends in the same way as Circle::GetAxis.
+// The normal points from the capsule to the shape.
+bool ConvexToCapsuleSAT(const Vector2* Vertices, const int NumVertices, const Vector2* Axes, const int NumAxes, const Vector2& Centre, Capsule& Cap, CollisionData& Data)
+{
+	const int MaxCapsuleAxes = 3;
+	Vector2 CapsuleAxes[MaxCapsuleAxes];
+	int NumCapsuleAxes = 0;
+
+	// Capsule normal
+	Vector2 Line = Cap.mEndsPositions[1].Subtract(Cap.mEndsPositions[0]);
+	if (Line.DotProduct(Line) > 0.0f)
+	{
+		Line.Normalise();
+		CapsuleAxes[NumCapsuleAxes++] = Line.PerpendicularVector();
+	}
+
+	// Axis from each end to the closest vertex
+	for (int i = 0; i < 2; i++)
+	{
+		float MinDistSquared = FLT_MAX;
+		Vector2 ToClosest = { 0.0f, 0.0f };
+
+		for (int j = 0; j < NumVertices; j++)
+		{
+			Vector2 ToVertex = Vertices[j].Subtract(Cap.mEndsPositions[i]);
+			float DistSquared = ToVertex.DotProduct(ToVertex);
+
+			if (DistSquared < MinDistSquared)
+			{
+				MinDistSquared = DistSquared;
+				ToClosest = ToVertex;
+			}
+		}
+
+		if (MinDistSquared > 0.0f)
+		{
+			ToClosest.Normalise();
+			CapsuleAxes[NumCapsuleAxes++] = ToClosest;
+		}
+	}
+
+	float Min1, Max1, Min2, Max2;
+
+	for (int i = 0; i < NumAxes + NumCapsuleAxes; i++)
+	{
+		const Vector2& Axis = (i < NumAxes) ? Axes[i] : CapsuleAxes[i - NumAxes];
+
+		// Project shape vertices
+		Min1 = Vertices[0].DotProduct(Axis);
+		Max1 = Min1;
+		for (int j = 1; j < NumVertices; j++)
+		{
+			const float Projection = Vertices[j].DotProduct(Axis);
+			Min1 = std::min(Min1, Projection);
+			Max1 = std::max(Max1, Projection);
+		}
+
+		GetMinMaxOnAxisCapsule(Axis, Cap, Min2, Max2);
+
+		if (!CheckOverlapOnAxis(Axis, Min1, Max1, Min2, Max2, Data))
+		{
+			return false;
+		}
+	}
+
+	Data.OrientNormal(Centre.Subtract(Cap.mCentrePosition));
+	return true;
+}
+
+// Determines if two AABBs are colliding. Returns true if they are.
+// Only interval comparisons are needed, the overlap on each world axis is the penetration on that axis.
+// Collision Data is updated with the normal pointing from the Second box to the First.
+bool TwoAABBsSAT(AABB& First, AABB& Second, CollisionData& Data)
+{
+	First.UpdateCentrePos();
+	Second.UpdateCentrePos();
+
+	const Vector2 Between = First.mCentrePosition.Subtract(Second.mCentrePosition);
+	const float OverlapX = First.mHalfSize.x + Second.mHalfSize.x - fabs(Between.x);
+	const float OverlapZ = First.mHalfSize.y + Second.mHalfSize.y - fabs(Between.y);
+
+	if (OverlapX < 0.0f || OverlapZ < 0.0f)
+	{
+		Data.mSeparatingAxis = (OverlapX < 0.0f) ? Vector2(1.0f, 0.0f) : Vector2(0.0f, 1.0f);
+		return false;
+	}
+
+	if (OverlapX < OverlapZ)
+	{
+		Data.UpdateData({ Between.x < 0.0f ? -1.0f : 1.0f, 0.0f }, OverlapX);
+	}
+	else
+	{
+		Data.UpdateData({ 0.0f, Between.y < 0.0f ? -1.0f : 1.0f }, OverlapZ);
+	}
+
+	return true;
+}
+
+// Determines if an AABB and an OBB are colliding. Returns true if they are.
+// Collision Data is updated with the normal pointing from the OBB to the AABB.
+bool AABBToOBBSAT(AABB& First, OBB& Second, CollisionData& Data)
+{
+	First.UpdateCentrePos();
+	Second.UpdateAxes();
+
+	const Vector2 WorldAxes[SquareNumAxesToCheck] = { { 1.0f, 0.0f }, { 0.0f, 1.0f } };
+	return BoxesSAT(First.mCentrePosition, WorldAxes, First.mHalfSize, Second.mCentrePosition, Second.mAxes, Second.mHalfSize, Data);
+}
+
+// Determines if an AABB and a Circle are colliding. Returns true if they are.
+// Collision Data is updated with the normal pointing from the Circle to the AABB.
+bool AABBToCircleSAT(AABB& FirstBox, Circle& SecondCircle, CollisionData& Data)
+{
+	FirstBox.UpdateCentrePos();
+	SecondCircle.UpdateCentrePos();
+
+	const Vector2 WorldAxes[SquareNumAxesToCheck] = { { 1.0f, 0.0f }, { 0.0f, 1.0f } };
+	return BoxToCircleSAT(FirstBox.mCentrePosition, WorldAxes, FirstBox.mHalfSize, SecondCircle, Data);
+}
+
+// Determines if an AABB and a Capsule are colliding. Returns true if they are.
+// Collision Data is updated with the normal pointing from the Capsule to the AABB.
+bool AABBToCapsuleSAT(AABB& FirstBox, Capsule& SecondCapsule, CollisionData& Data)
+{
+	FirstBox.UpdateCentrePos();
+	SecondCapsule.UpdateEndsPosition();
+
+	const Vector2 WorldAxes[SquareNumAxesToCheck] = { { 1.0f, 0.0f }, { 0.0f, 1.0f } };
+	const BoundingBox Box = FirstBox.GetBoundingBox();
+	const Vector2 Corners[SquareNumCorners] = { Box.mMin, { Box.mMax.x, Box.mMin.y }, Box.mMax, { Box.mMin.x, Box.mMax.y } };
+
+	return ConvexToCapsuleSAT(Corners, SquareNumCorners, WorldAxes, SquareNumAxesToCheck, FirstBox.mCentrePosition, SecondCapsule, Data);
+}
+
+// Determines if a Polygon and an AABB are colliding. Returns true if they are.
+// Collision Data is updated with the normal pointing from the AABB to the Polygon.
+bool ShapeToAABBSAT(Polygon& FirstPolygon, AABB& SecondBox, CollisionData& Data)
+{
+	FirstPolygon.UpdateVerticesPosition();
+	FirstPolygon.UpdateAxes();
+	SecondBox.UpdateCentrePos();
+
+	const Vector2 WorldAxes[SquareNumAxesToCheck] = { { 1.0f, 0.0f }, { 0.0f, 1.0f } };
+	float Min1, Max1, Min2, Max2;
+
+	// Polygon axes
+	for (int i = 0; i < FirstPolygon.mAxes.size(); i++)
+	{
+		GetMinMaxVertexOnAxisShape(FirstPolygon.mAxes.at(i), FirstPolygon, Min1, Max1);
+		GetMinMaxOnAxisBox(FirstPolygon.mAxes.at(i), SecondBox.mCentrePosition, WorldAxes, SecondBox.mHalfSize, Min2, Max2);
+
+		if (!CheckOverlapOnAxis(FirstPolygon.mAxes.at(i), Min1, Max1, Min2, Max2, Data))
+		{
+			return false;
+		}
+	}
+
+	// Box axes
+	const BoundingBox Box = SecondBox.GetBoundingBox();
+	for (int i = 0; i < SquareNumAxesToCheck; i++)
+	{
+		GetMinMaxVertexOnAxisShape(WorldAxes[i], FirstPolygon, Min1, Max1);
+		Min2 = (i == 0) ? Box.mMin.x : Box.mMin.y;
+		Max2 = (i == 0) ? Box.mMax.x : Box.mMax.y;
+
+		if (!CheckOverlapOnAxis(WorldAxes[i], Min1, Max1, Min2, Max2, Data))
+		{
+			return false;
+		}
+	}
+
+	Data.OrientNormal(FirstPolygon.mCentrePosition.Subtract(SecondBox.mCentrePosition));
+	return true;
+}
+
+// Determines if two OBBs are colliding. Returns true if they are.
+// Collision Data is updated with the normal pointing from the Second box to the First.
+bool TwoOBBsSAT(OBB& First, OBB& Second, CollisionData& Data)
+{
+	First.UpdateAxes();
+	Second.UpdateAxes();
+
+	return BoxesSAT(First.mCentrePosition, First.mAxes, First.mHalfSize, Second.mCentrePosition, Second.mAxes, Second.mHalfSize, Data);
+}
+
+// Determines if an OBB and a Circle are colliding. Returns true if they are.
+// Collision Data is updated with the normal pointing from the Circle to the OBB.
+bool OBBToCircleSAT(OBB& FirstBox, Circle& SecondCircle, CollisionData& Data)
+{
+	FirstBox.UpdateAxes();
+	SecondCircle.UpdateCentrePos();
+
+	return BoxToCircleSAT(FirstBox.mCentrePosition, FirstBox.mAxes, FirstBox.mHalfSize, SecondCircle, Data);
+}
+
+// Determines if an OBB and a Capsule are colliding. Returns true if they are.
+// Collision Data is updated with the normal pointing from the Capsule to the OBB.
+bool OBBToCapsuleSAT(OBB& FirstBox, Capsule& SecondCapsule, CollisionData& Data)
+{
+	FirstBox.UpdateAxes();
+	SecondCapsule.UpdateEndsPosition();
+
+	Vector2 Corners[SquareNumCorners];
+	FirstBox.GetCornersPositions(Corners);
+
+	return ConvexToCapsuleSAT(Corners, SquareNumCorners, FirstBox.mAxes, SquareNumAxesToCheck, FirstBox.mCentrePosition, SecondCapsule, Data);
+}
+
+// Determines if a Polygon and an OBB are colliding. Returns true if they are.
+// Collision Data is updated with the normal pointing from the OBB to the Polygon.
+bool ShapeToOBBSAT(Polygon& FirstPolygon, OBB& SecondBox, CollisionData& Data)
+{
+	FirstPolygon.UpdateVerticesPosition();
+	FirstPolygon.UpdateAxes();
+	SecondBox.UpdateAxes();
+
+	float Min1, Max1, Min2, Max2;
+
+	for (int i = 0; i < FirstPolygon.mAxes.size() + SquareNumAxesToCheck; i++)
+	{
+		const Vector2& Axis = (i < FirstPolygon.mAxes.size()) ? FirstPolygon.mAxes.at(i) : SecondBox.mAxes[i - FirstPolygon.mAxes.size()];
+
+		GetMinMaxVertexOnAxisShape(Axis, FirstPolygon, Min1, Max1);
+		GetMinMaxOnAxisBox(Axis, SecondBox.mCentrePosition, SecondBox.mAxes, SecondBox.mHalfSize, Min2, Max2);
+
+		if (!CheckOverlapOnAxis(Axis, Min1, Max1, Min2, Max2, Data))
+		{
+			return false;
+		}
+	}
+
+	Data.OrientNormal(FirstPolygon.mCentrePosition.Subtract(SecondBox.mCentrePosition));
+	return true;
+}
+
+// Determines if two Capsules are colliding. Returns true if they are.
+// They collide if the closest points on their lines are closer than the sum of the radii.
+// If the lines cross, there is no single closest direction, so SAT is used on the normal and direction of each line.
+// Collision Data is updated with the normal pointing from the Second capsule to the First.
+bool TwoCapsulesSAT(Capsule& First, Capsule& Second, CollisionData& Data)
+{
+	First.UpdateEndsPosition();
+	Second.UpdateEndsPosition();
+
+	Vector2 Closest1, Closest2;
+	ClosestPointsBetweenSegments(First.mEndsPositions[0], First.mEndsPositions[1], Second.mEndsPositions[0], Second.mEndsPositions[1], Closest1, Closest2);
+
+	const Vector2 Between = Closest1.Subtract(Closest2);
+	const float Distance = Between.Length();
+	const float RadiusSum = First.mRadius + Second.mRadius;
+
+	if (Distance > RadiusSum)
+	{
+		Data.mSeparatingAxis = Between.MultiplyScalar(1.0f / Distance);
+		return false;
+	}
+
+	// The direction between the closest points is only reliable if they aren't almost at the same point
+	if (Distance > CapsuleTouchingTolerance * RadiusSum)
+	{
+		Data.UpdateData(Between.MultiplyScalar(1.0f / Distance), RadiusSum - Distance);
+		return true;
+	}
+
+	// Lines cross, or one is a point on the other line
+	Vector2 Axes[4] = { First.mEndsPositions[1].Subtract(First.mEndsPositions[0]), Second.mEndsPositions[1].Subtract(Second.mEndsPositions[0]) };
+	if (Axes[0].DotProduct(Axes[0]) == 0.0f || Axes[1].DotProduct(Axes[1]) == 0.0f)
+	{
+		Data.UpdateData({ 0.0f, 1.0f }, RadiusSum);
+		return true;
+	}
+	Axes[0].Normalise();
+	Axes[1].Normalise();
+	Axes[2] = Axes[0].PerpendicularVector();
+	Axes[3] = Axes[1].PerpendicularVector();
+
+	float Min1, Max1, Min2, Max2;
+	for (int i = 0; i < 4; i++)
+	{
+		GetMinMaxOnAxisCapsule(Axes[i], First, Min1, Max1);
+		GetMinMaxOnAxisCapsule(Axes[i], Second, Min2, Max2);
+		CheckOverlapOnAxis(Axes[i], Min1, Max1, Min2, Max2, Data);
+	}
+
+	Data.OrientNormal(First.mCentrePosition.Subtract(Second.mCentrePosition));
+	return true;
+}
+
+// Determines if a Capsule and a Circle are colliding. Returns true if they are.
+// Collision Data is updated with the normal pointing from the Circle to the Capsule.
+bool CapsuleToCircleSAT(Capsule& FirstCapsule, Circle& SecondCircle, CollisionData& Data)
+{
+	FirstCapsule.UpdateEndsPosition();
+	SecondCircle.UpdateCentrePos();
+
+	const Vector2 Closest = ClosestPointOnSegment(SecondCircle.mCentrePosition, FirstCapsule.mEndsPositions[0], FirstCapsule.mEndsPositions[1]);
+	const Vector2 CircleToCapsule = Closest.Subtract(SecondCircle.mCentrePosition);
+	const float Distance = CircleToCapsule.Length();
+	const float RadiusSum = FirstCapsule.mRadius + SecondCircle.mRadius;
+
+	if (Distance > RadiusSum)
+	{
+		Data.mSeparatingAxis = CircleToCapsule.MultiplyScalar(1.0f / Distance);
+		return false;
+	}
+
+	// Circle centre on the line, push out sideways
+	if (Distance <= CapsuleTouchingTolerance * RadiusSum)
+	{
+		Vector2 Line = FirstCapsule.mEndsPositions[1].Subtract(FirstCapsule.mEndsPositions[0]);
+		if (Line.DotProduct(Line) == 0.0f)
+		{
+			Line = { 1.0f, 0.0f };
+		}
+		Line.Normalise();
+		Data.UpdateData(Line.PerpendicularVector(), RadiusSum);
+		return true;
+	}
+
+	Data.UpdateData(CircleToCapsule.MultiplyScalar(1.0f / Distance), RadiusSum - Distance);
+	return true;
+}
+
+// Determines if a Polygon and a Capsule are colliding. Returns true if they are.
+// Collision Data is updated with the normal pointing from the Capsule to the Polygon.
+bool ShapeToCapsuleSAT(Polygon& FirstPolygon, Capsule& SecondCapsule, CollisionData& Data)
+{
+	FirstPolygon.UpdateVerticesPosition();
+	FirstPolygon.UpdateAxes();
+	SecondCapsule.UpdateEndsPosition();
+
+	return ConvexToCapsuleSAT(FirstPolygon.mVerticesPositions.data(), static_cast<int>(FirstPolygon.mVerticesPositions.size()),
+		FirstPolygon.mAxes.data(), static_cast<int>(FirstPolygon.mAxes.size()), FirstPolygon.mCentrePosition, SecondCapsule, Data);
+}
+
+// Creates the centre model, and a reference dummy used to find the compound's rotation.
+void CompoundShape::InitialiseCompound(Mesh* CentreMesh, Mesh* DummyMesh)
+{
+	mCentre = CentreMesh->CreateModel();
+
+	mReference = DummyMesh->CreateModel();
+	mReference->AttachToParent(mCentre);
+	mReference->SetLocalX(1.0f);
+}
+
+// Adds a convex polygon part. LocalPoints are relative to the compound's centre, counter-clockwise.
+// The part's centre is put at the average of its points, so the normal direction test in SAT works for each part.
+// Returns false, and adds nothing, if the points aren't a polygon (see Polygon::InitialiseLocalVertices).
+bool CompoundShape::AddPolygon(Mesh* DummyMesh, Mesh* CornerMesh, const std::vector<Vector2>& LocalPoints)
+{
+	if (LocalPoints.empty())
+	{
+		return false;
+	}
+
+	Vector2 PartCentre = { 0.0f, 0.0f };
+	for (int i = 0; i < LocalPoints.size(); i++)
+	{
+		PartCentre = PartCentre.Add(LocalPoints.at(i));
+	}
+	PartCentre = PartCentre.MultiplyScalar(1.0f / LocalPoints.size());
+
+	std::vector<Vector2> PartPoints;
+	BoundingBox LocalBox = { LocalPoints.at(0), LocalPoints.at(0) };
+	for (int i = 0; i < LocalPoints.size(); i++)
+	{
+		PartPoints.push_back(LocalPoints.at(i).Subtract(PartCentre));
+		LocalBox = LocalBox.Merge({ LocalPoints.at(i), LocalPoints.at(i) });
+	}
+
+	Polygon Part;
+	if (!Part.InitialiseLocalVertices(DummyMesh, CornerMesh, PartPoints))
+	{
+		return false;
+	}
+	Part.mCentre->AttachToParent(mCentre);
+	Part.mCentre->SetLocalX(PartCentre.x);
+	Part.mCentre->SetLocalZ(PartCentre.y);
+
+	mParts.push_back({ false, static_cast<int>(mPolygons.size()), LocalBox });
+	mPolygons.push_back(Part);
+	return true;
+}
+
+// Adds a circle part. LocalPos is relative to the compound's centre.
+void CompoundShape::AddCircle(Mesh* CentreMesh, const float Radius, const Vector2& LocalPos)
+{
+	Circle Part;
+	Part.InitialiseCircle(CentreMesh, Radius);
+	Part.mCentre->AttachToParent(mCentre);
+	Part.mCentre->SetLocalX(LocalPos.x);
+	Part.mCentre->SetLocalZ(LocalPos.y);
+
+	BoundingBox LocalBox;
+	LocalBox.mMin = { LocalPos.x - Radius, LocalPos.y - Radius };
+	LocalBox.mMax = { LocalPos.x + Radius, LocalPos.y + Radius };
+
+	mParts.push_back({ true, static_cast<int>(mCircles.size()), LocalBox });
+	mCircles.push_back(Part);
+}
+
+// Adds a concave outline (relative to the compound's centre) as several convex polygon parts.
+// The split is stored in Cache, so loading the same outline again doesn't split it again.
+// Returns false, and adds no parts, if the outline can't be split (e.g. it is self intersecting).
+bool CompoundShape::AddConcaveOutline(Mesh* DummyMesh, Mesh* CornerMesh, const std::vector<Vector2>& Outline, ConvexDecompositionCache& Cache)
+{
+	const std::vector<std::vector<Vector2>>* Pieces = Cache.GetPieces(Outline);
+	if (Pieces == nullptr)
+	{
+		return false;
+	}
+
+	for (int i = 0; i < Pieces->size(); i++)
+	{
+		AddPolygon(DummyMesh, CornerMesh, Pieces->at(i));
+	}
+	return true;
+}
+
+// Builds the bounding hierarchy over all parts. Must be called after the last part is added.
+void CompoundShape::BuildHierarchy()
+{
+	mNodes.clear();
+	mFoundParts.reserve(mParts.size());
+
+	if (mParts.empty())
+	{
+		return;
+	}
+
+	std::vector<int> PartIndices;
+	for (int i = 0; i < mParts.size(); i++)
+	{
+		PartIndices.push_back(i);
+	}
+
+	mNodes.reserve(2 * mParts.size() - 1);
+	BuildNode(PartIndices, 0, static_cast<int>(PartIndices.size()));
+}
+
+// Builds a node for the parts in PartIndices from First up to (not including) Last, and returns its index.
+// Parts are split in half along the longest side of their box, so the tree is balanced.
+int CompoundShape::BuildNode(std::vector<int>& PartIndices, const int First, const int Last)
+{
+	const int NodeIndex = static_cast<int>(mNodes.size());
+	mNodes.push_back({ mParts.at(PartIndices.at(First)).mLocalBox, -1, -1, -1 });
+
+	// Leaf
+	if (Last - First == 1)
+	{
+		mNodes.at(NodeIndex).mPart = PartIndices.at(First);
+		return NodeIndex;
+	}
+
+	BoundingBox NodeBox = mNodes.at(NodeIndex).mLocalBox;
+	for (int i = First + 1; i < Last; i++)
+	{
+		NodeBox = NodeBox.Merge(mParts.at(PartIndices.at(i)).mLocalBox);
+	}
+
+	// Sort parts by their centre along the longest side
+	const bool bSplitX = (NodeBox.mMax.x - NodeBox.mMin.x) >= (NodeBox.mMax.y - NodeBox.mMin.y);
+	std::sort(PartIndices.begin() + First, PartIndices.begin() + Last, [&](const int A, const int B)
+		{
+			const Vector2 CentreA = mParts.at(A).mLocalBox.GetCentre();
+			const Vector2 CentreB = mParts.at(B).mLocalBox.GetCentre();
+			return bSplitX ? CentreA.x < CentreB.x : CentreA.y < CentreB.y;
+		});
+
+	const int Middle = (First + Last) / 2;
+	const int Left = BuildNode(PartIndices, First, Middle);
+	const int Right = BuildNode(PartIndices, Middle, Last);
+
+	mNodes.at(NodeIndex).mLocalBox = NodeBox;
+	mNodes.at(NodeIndex).mLeft = Left;
+	mNodes.at(NodeIndex).mRight = Right;
+	return NodeIndex;
+}
+
+// Finds the parts whose bounding box overlaps WorldBox, and stores their indices in mFoundParts.
+// The box is moved into the compound's local space rather than moving every part's box into world space.
+void CompoundShape::QueryParts(const BoundingBox& WorldBox)
+{
+	mFoundParts.clear();
+
+	if (mNodes.empty())
+	{
+		return;
+	}
+
+	// Rotation of the compound from its reference dummy
+	const Vector2 CentrePos = GetCentrePos();
+	const Vector2 ReferenceDirection = Vector2(mReference->GetX(), mReference->GetZ()).Subtract(CentrePos);
+	const float Cos = ReferenceDirection.x;
+	const float Sin = ReferenceDirection.y;
+
+	// Rotate the box centre back into local space, and grow the box so it still contains the rotated box
+	const Vector2 WorldCentre = WorldBox.GetCentre().Subtract(CentrePos);
+	const Vector2 LocalCentre = WorldCentre.Rotate(Cos, -Sin);
+	const float HalfWidth = 0.5f * (WorldBox.mMax.x - WorldBox.mMin.x);
+	const float HalfHeight = 0.5f * (WorldBox.mMax.y - WorldBox.mMin.y);
+	const Vector2 LocalHalfSize = Vector2(fabs(Cos) * HalfWidth + fabs(Sin) * HalfHeight, fabs(Sin) * HalfWidth + fabs(Cos) * HalfHeight);
+
+	BoundingBox LocalBox = { LocalCentre.Subtract(LocalHalfSize), LocalCentre.Add(LocalHalfSize) };
+
+	// Depth first through the tree. The tree is balanced, so it is never deeper than the stack.
+	const int MaxStackSize = 64;
+	int Stack[MaxStackSize];
+	int StackSize = 0;
+	Stack[StackSize++] = 0;
+
+	while (StackSize > 0)
+	{
+		const BoundingNode& Node = mNodes.at(Stack[--StackSize]);
+
+		if (!Node.mLocalBox.Overlaps(LocalBox))
+		{
+			continue;
+		}
+
+		if (Node.mPart != -1)
+		{
+			mFoundParts.push_back(Node.mPart);
+		}
+		else
+		{
+			Stack[StackSize++] = Node.mLeft;
+			Stack[StackSize++] = Node.mRight;
+		}
+	}
+}
+
+// Sets the skin of every part's centre model.
+void CompoundShape::SetPartsSkin(const std::string& SkinName)
+{
+	for (int i = 0; i < mPolygons.size(); i++)
+	{
+		mPolygons.at(i).mCentre->SetSkin(SkinName);
+	}
+
+	for (int i = 0; i < mCircles.size(); i++)
+	{
+		mCircles.at(i).mCentre->SetSkin(SkinName);
+	}
+}
+
+// Box around the whole compound in world space, grown from the root of the hierarchy so it contains it at any rotation.
+BoundingBox CompoundShape::GetBoundingBox() const
+{
+	const Vector2 CentrePos = GetCentrePos();
+	if (mNodes.empty())
+	{
+		return { CentrePos, CentrePos };
+	}
+
+	const Vector2 ReferenceDirection = Vector2(mReference->GetX(), mReference->GetZ()).Subtract(CentrePos);
+	const float Cos = ReferenceDirection.x;
+	const float Sin = ReferenceDirection.y;
+
+	const BoundingBox& LocalBox = mNodes.at(0).mLocalBox;
+	const Vector2 WorldCentre = LocalBox.GetCentre().Rotate(Cos, Sin).Add(CentrePos);
+	const float HalfWidth = 0.5f * (LocalBox.mMax.x - LocalBox.mMin.x);
+	const float HalfHeight = 0.5f * (LocalBox.mMax.y - LocalBox.mMin.y);
+	const Vector2 WorldHalfSize = Vector2(fabs(Cos) * HalfWidth + fabs(Sin) * HalfHeight, fabs(Sin) * HalfWidth + fabs(Cos) * HalfHeight);
+
+	return { WorldCentre.Subtract(WorldHalfSize), WorldCentre.Add(WorldHalfSize) };
+}
+
+// Tests a shape of any type against each part of the Compound whose bounding box overlaps FirstBox, the shape's box in world space.
+// The test for each part is picked at compile time like any other pair of shapes.
+// Collision Data is updated with the deepest collision of any part, with the normal pointing from the Compound to the shape.
+template<typename ShapeType>
+bool ShapeToCompoundPartsSAT(ShapeType& FirstShape, const BoundingBox& FirstBox, CompoundShape& SecondCompound, CollisionData& Data)
+{
+	SecondCompound.QueryParts(FirstBox);
+
+	bool bColliding = false;
+	for (int i = 0; i < SecondCompound.mFoundParts.size(); i++)
+	{
+		const CompoundPart& Part = SecondCompound.mParts.at(SecondCompound.mFoundParts.at(i));
+
+		CollisionData PartData;
+		PartData.InitialiseData();
+
+		bool bPartColliding;
+		if (Part.mIsCircle)
+		{
+			bPartColliding = PairKernel<ShapeType, Circle>::Test(FirstShape, SecondCompound.mCircles.at(Part.mIndex), PartData);
+		}
+		else
+		{
+			bPartColliding = PairKernel<ShapeType, Polygon>::Test(FirstShape, SecondCompound.mPolygons.at(Part.mIndex), PartData);
+		}
+
+		if (bPartColliding && (!bColliding || PartData.mPenetration > Data.mPenetration))
+		{
+			Data = PartData;
+			bColliding = true;
+		}
+	}
+
+	return bColliding;
+}
+
+// Determines if a Polygon and a Compound are colliding. Returns true if they are.
+// Only parts whose bounding box overlaps the polygon's are tested.
+// Collision Data is updated with the deepest collision of any part, with the normal pointing from the Compound to the Polygon.
+bool ShapeToCompoundSAT(Polygon& FirstPolygon, CompoundShape& SecondCompound, CollisionData& Data)
+{
+	FirstPolygon.UpdateVerticesPosition();
+	return ShapeToCompoundPartsSAT(FirstPolygon, FirstPolygon.GetBoundingBox(), SecondCompound, Data);
+}
+
+// Determines if a Compound and a Circle are colliding. Returns true if they are.
+// Only parts whose bounding box overlaps the circle's are tested.
+// Collision Data is updated with the deepest collision of any part, with the normal pointing from the Circle to the Compound.
+bool CompoundToCircleSAT(CompoundShape& FirstCompound, Circle& SecondCircle, CollisionData& Data)
+{
+	SecondCircle.UpdateCentrePos();
+	const bool bColliding = ShapeToCompoundPartsSAT(SecondCircle, SecondCircle.GetBoundingBox(), FirstCompound, Data);
+	Data.mNormal.Reverse();
+	return bColliding;
+}
+
+// Determines if an AABB and a Compound are colliding. Returns true if they are.
+// Only parts whose bounding box overlaps the box are tested.
+// Collision Data is updated with the deepest collision of any part, with the normal pointing from the Compound to the AABB.
+bool AABBToCompoundSAT(AABB& FirstBox, CompoundShape& SecondCompound, CollisionData& Data)
+{
+	FirstBox.UpdateCentrePos();
+	return ShapeToCompoundPartsSAT(FirstBox, FirstBox.GetBoundingBox(), SecondCompound, Data);
+}
+
+// Determines if an OBB and a Compound are colliding. Returns true if they are.
+// Only parts whose bounding box overlaps the box's are tested.
+// Collision Data is updated with the deepest collision of any part, with the normal pointing from the Compound to the OBB.
+bool OBBToCompoundSAT(OBB& FirstBox, CompoundShape& SecondCompound, CollisionData& Data)
+{
+	FirstBox.UpdateAxes();
+	return ShapeToCompoundPartsSAT(FirstBox, FirstBox.GetBoundingBox(), SecondCompound, Data);
+}
+
+// Determines if a Capsule and a Compound are colliding. Returns true if they are.
+// Only parts whose bounding box overlaps the capsule's are tested.
+// Collision Data is updated with the deepest collision of any part, with the normal pointing from the Compound to the Capsule.
+bool CapsuleToCompoundSAT(Capsule& FirstCapsule, CompoundShape& SecondCompound, CollisionData& Data)
+{
+	FirstCapsule.UpdateEndsPosition();
+	return ShapeToCompoundPartsSAT(FirstCapsule, FirstCapsule.GetBoundingBox(), SecondCompound, Data);
+}
+
+// Determines if two Compounds are colliding. Returns true if they are.
+// Parts of the First that overlap the Second's bounding box are each tested against the parts of the Second near them.
+// Collision Data is updated with the deepest collision of any two parts, with the normal pointing from the Second to the First.
+bool TwoCompoundsSAT(CompoundShape& First, CompoundShape& Second, CollisionData& Data)
+{
+	First.QueryParts(Second.GetBoundingBox());
+
+	bool bColliding = false;
+	for (int i = 0; i < First.mFoundParts.size(); i++)
+	{
+		const CompoundPart& Part = First.mParts.at(First.mFoundParts.at(i));
+
+		CollisionData PartData;
+		PartData.InitialiseData();
+
+		bool bPartColliding;
+		if (Part.mIsCircle)
+		{
+			Circle& PartCircle = First.mCircles.at(Part.mIndex);
+			PartCircle.UpdateCentrePos();
+			bPartColliding = ShapeToCompoundPartsSAT(PartCircle, PartCircle.GetBoundingBox(), Second, PartData);
+		}
+		else
+		{
+			Polygon& PartPolygon = First.mPolygons.at(Part.mIndex);
+			PartPolygon.UpdateVerticesPosition();
+			bPartColliding = ShapeToCompoundPartsSAT(PartPolygon, PartPolygon.GetBoundingBox(), Second, PartData);
+		}
+
+		if (bPartColliding && (!bColliding || PartData.mPenetration > Data.mPenetration))
+		{
+			Data = PartData;
+			bColliding = true;
+		}
+	}
+
+	return bColliding;
+}
+
+// Returns the index of a free item, growing the pool only if no freed items are left.
+template<typename T>
+int PoolAllocator<T>::Allocate()
+{
+	if (!mFreeItems.empty())
+	{
+		const int Index = mFreeItems.back();
+		mFreeItems.pop_back();
+		return Index;
+	}
+
+	if (mItems.size() == mItems.capacity())
+	{
+		mNumGrowths++;
+	}
+
+	mItems.push_back(T());
+
+	// Make sure freeing every item never needs to grow the free list
+	if (mFreeItems.capacity() < mItems.capacity())
+	{
+		mFreeItems.reserve(mItems.capacity());
+	}
+
+	return static_cast<int>(mItems.size()) - 1;
+}
+
+// Returns the item to the pool. Its memory is kept for the next Allocate.
+template<typename T>
+void PoolAllocator<T>::Free(const int Index)
+{
+	mFreeItems.push_back(Index);
+}
+
+// Makes space for NumItems up front, so the pool doesn't grow during a frame.
+template<typename T>
+void PoolAllocator<T>::Reserve(const int NumItems)
+{
+	mItems.reserve(NumItems);
+	mFreeItems.reserve(NumItems);
+}
+
+// Returns Size bytes that last until the next Reset. Alignment must be a power of 2, no bigger than the default new alignment.
+void* FrameArena::Allocate(const std::size_t Size, const std::size_t Alignment)
+{
+	const std::size_t Start = (mUsed + Alignment - 1) & ~(Alignment - 1);
+
+	if (Start + Size <= mBlockSize)
+	{
+		mUsed = Start + Size;
+		return mBlock + Start;
+	}
+
+	// Doesn't fit, so use an extra block until the next reset
+	unsigned char* Extra = new unsigned char[Size];
+	mOverflowBlocks.push_back(Extra);
+	mOverflowSize += Size;
+	return Extra;
+}
+
+template<typename T>
+T* FrameArena::AllocateArray(const int Count)
+{
+	return static_cast<T*>(Allocate(sizeof(T) * Count, alignof(T)));
+}
+
+// Frees everything allocated this frame. If extra blocks were needed, the block grows to fit them next time.
+void FrameArena::Reset()
+{
+	mUsed = 0;
+
+	if (mOverflowBlocks.empty())
+	{
+		return;
+	}
+
+	const std::size_t NewBlockSize = 2 * (mBlockSize + mOverflowSize);
+	Release();
+
+	mBlock = new unsigned char[NewBlockSize];
+	mBlockSize = NewBlockSize;
+	mNumGrowths++;
+}
+
+// Frees all memory, including the block.
+void FrameArena::Release()
+{
+	for (int i = 0; i < mOverflowBlocks.size(); i++)
+	{
+		delete[] mOverflowBlocks.at(i);
+	}
+	mOverflowBlocks.clear();
+	mOverflowSize = 0;
+
+	if (mBlock != nullptr)
+	{
+		delete[] mBlock;
+		mBlock = nullptr;
+	}
+	mBlockSize = 0;
+	mUsed = 0;
+}
+
+FrameArena::~FrameArena()
+{
+	Release();
+}
+
+// Returns the entry for the pair, adding it if it isn't in the cache. Bodies must always be given in the same order.
+int PairCache::FindOrAdd(const int FirstBody, const int SecondBody)
+{
+	if (mBuckets.empty())
+	{
+		Rehash(PairCacheMinBuckets);
+	}
+
+	int Bucket = GetBucket(FirstBody, SecondBody);
+	for (int i = mBuckets.at(Bucket); i != -1; i = mEntries.mItems.at(i).mNext)
+	{
+		const PairCacheEntry& Entry = mEntries.mItems.at(i);
+		if (Entry.mFirstBody == FirstBody && Entry.mSecondBody == SecondBody)
+		{
+			return i;
+		}
+	}
+
+	// Keep buckets short by doubling them when they are 3/4 full
+	if (4 * (mNumEntries + 1) > 3 * static_cast<int>(mBuckets.size()))
+	{
+		Rehash(2 * static_cast<int>(mBuckets.size()));
+		Bucket = GetBucket(FirstBody, SecondBody);
+	}
+
+	const int Index = mEntries.Allocate();
+	PairCacheEntry& Entry = mEntries.mItems.at(Index);
+	Entry.mFirstBody = FirstBody;
+	Entry.mSecondBody = SecondBody;
+	Entry.mNext = mBuckets.at(Bucket);
+	Entry.mLastFrame = -1;
+	Entry.mInUse = true;
+	Entry.mIsColliding = false;
+	Entry.mHasSeparatingAxis = false;
+	Entry.mData.InitialiseData();
+
+	mBuckets.at(Bucket) = Index;
+	mNumEntries++;
+	return Index;
+}
+
+// Removes the entry from its bucket and gives it back to the pool.
+void PairCache::Remove(const int EntryIndex)
+{
+	PairCacheEntry& Entry = mEntries.mItems.at(EntryIndex);
+	const int Bucket = GetBucket(Entry.mFirstBody, Entry.mSecondBody);
+
+	if (mBuckets.at(Bucket) == EntryIndex)
+	{
+		mBuckets.at(Bucket) = Entry.mNext;
+	}
+	else
+	{
+		int Previous = mBuckets.at(Bucket);
+		while (mEntries.mItems.at(Previous).mNext != EntryIndex)
+		{
+			Previous = mEntries.mItems.at(Previous).mNext;
+		}
+		mEntries.mItems.at(Previous).mNext = Entry.mNext;
+	}
+
+	Entry.mInUse = false;
+	mEntries.Free(EntryIndex);
+	mNumEntries--;
+}
+
+// Fibonacci hash of both body indices. Uses the top bits, as they are the best mixed.
+int PairCache::GetBucket(const int FirstBody, const int SecondBody) const
+{
+	const unsigned long long Key = (static_cast<unsigned long long>(FirstBody) << 32) | static_cast<unsigned int>(SecondBody);
+	const unsigned long long Hash = Key * 0x9E3779B97F4A7C15ull;
+	return static_cast<int>((Hash >> 32) & (mBuckets.size() - 1));
+}
+
+// Changes the number of buckets (must be a power of 2) and puts every entry in its new bucket.
+void PairCache::Rehash(const int NumBuckets)
+{
+	if (!mBuckets.empty())
+	{
+		mNumGrowths++;
+	}
+
+	mBuckets.assign(NumBuckets, -1);
+
+	for (int i = 0; i < mEntries.mItems.size(); i++)
+	{
+		PairCacheEntry& Entry = mEntries.mItems.at(i);
+		if (Entry.mInUse)
+		{
+			const int Bucket = GetBucket(Entry.mFirstBody, Entry.mSecondBody);
+			Entry.mNext = mBuckets.at(Bucket);
+			mBuckets.at(Bucket) = i;
+		}
+	}
+}
+
+// Makes space for NumPairs pairs up front, so the cache doesn't grow when new pairs appear.
+void PairCache::Reserve(const int NumPairs)
+{
+	mEntries.Reserve(NumPairs);
+
+	int NumBuckets = PairCacheMinBuckets;
+	while (4 * NumPairs > 3 * NumBuckets)
+	{
+		NumBuckets *= 2;
+	}
+
+	if (NumBuckets > mBuckets.size())
+	{
+		Rehash(NumBuckets);
+	}
+}
+
+int CollisionWorld::AddBody(const Circle& NewShape, const Vector2& Position, const float Rotation, const bool bIsStatic)
+{
+	mCircles.push_back(NewShape);
+	return AddBody(eShapeCircle, static_cast<int>(mCircles.size()) - 1, Position, Rotation, bIsStatic);
+}
+
+int CollisionWorld::AddBody(const Polygon& NewShape, const Vector2& Position, const float Rotation, const bool bIsStatic)
+{
+	mPolygons.push_back(NewShape);
+	return AddBody(eShapePolygon, static_cast<int>(mPolygons.size()) - 1, Position, Rotation, bIsStatic);
+}
+
+int CollisionWorld::AddBody(const AABB& NewShape, const Vector2& Position, const float Rotation, const bool bIsStatic)
+{
+	mAABBs.push_back(NewShape);
+	return AddBody(eShapeAABB, static_cast<int>(mAABBs.size()) - 1, Position, Rotation, bIsStatic);
+}
+
+int CollisionWorld::AddBody(const OBB& NewShape, const Vector2& Position, const float Rotation, const bool bIsStatic)
+{
+	mOBBs.push_back(NewShape);
+	return AddBody(eShapeOBB, static_cast<int>(mOBBs.size()) - 1, Position, Rotation, bIsStatic);
+}
+
+int CollisionWorld::AddBody(const Capsule& NewShape, const Vector2& Position, const float Rotation, const bool bIsStatic)
+{
+	mCapsules.push_back(NewShape);
+	return AddBody(eShapeCapsule, static_cast<int>(mCapsules.size()) - 1, Position, Rotation, bIsStatic);
+}
+
+// Adds a body for a shape already in the world's array for its type. Shapes must have been created without models.
+// Returns the index of the body. Set its velocities through mBodies.
+int CollisionWorld::AddBody(const EShapeType Type, const int ShapeIndex, const Vector2& Position, const float Rotation, const bool bIsStatic)
+{
+	CollisionBody Body;
+	Body.mType = Type;
+	Body.mShapeIndex = ShapeIndex;
+	Body.mPosition = Position;
+	Body.mRotation = Rotation;
+	Body.mVelocity = { 0.0f, 0.0f };
+	Body.mAngularVelocity = 0.0f;
+	Body.mIsStatic = bIsStatic;
+	UpdateBody(Body);
+
+	mBodies.push_back(Body);
+	mSortedBodies.push_back(static_cast<int>(mBodies.size()) - 1);
+	mQueryFrame = -1;
+	return static_cast<int>(mBodies.size()) - 1;
+}
+
+// Moves the body's shape to the body's position and rotation, and updates its bounding box.
+void CollisionWorld::UpdateBody(CollisionBody& Body)
+{
+	const float Cos = cos(Body.mRotation * DegreesToRadians);
+	const float Sin = sin(Body.mRotation * DegreesToRadians);
+
+	switch (Body.mType)
+	{
+	case eShapeCircle:
+		mCircles.at(Body.mShapeIndex).SetTransform(Body.mPosition, Cos, Sin);
+		Body.mBox = mCircles.at(Body.mShapeIndex).GetBoundingBox();
+		break;
+	case eShapePolygon:
+		mPolygons.at(Body.mShapeIndex).SetTransform(Body.mPosition, Cos, Sin);
+		Body.mBox = mPolygons.at(Body.mShapeIndex).GetBoundingBox();
+		break;
+	case eShapeAABB:
+		mAABBs.at(Body.mShapeIndex).SetTransform(Body.mPosition, Cos, Sin);
+		Body.mBox = mAABBs.at(Body.mShapeIndex).GetBoundingBox();
+		break;
+	case eShapeOBB:
+		mOBBs.at(Body.mShapeIndex).SetTransform(Body.mPosition, Cos, Sin);
+		Body.mBox = mOBBs.at(Body.mShapeIndex).GetBoundingBox();
+		break;
+	case eShapeCapsule:
+		mCapsules.at(Body.mShapeIndex).SetTransform(Body.mPosition, Cos, Sin);
+		Body.mBox = mCapsules.at(Body.mShapeIndex).GetBoundingBox();
+		break;
+	default:
+		break;
+	}
+}
+
+// Moves every dynamic body, finds pairs with overlapping bounding boxes (sort and sweep along X),
+// then tests and resolves each pair. State for each pair is kept in the pair cache between steps.
+void CollisionWorld::Step(const float DeltaTime)
+{
+	mFrame++;
+	mStats = {};
+
+	// Move dynamic bodies
+	for (int i = 0; i < mBodies.size(); i++)
+	{
+		CollisionBody& Body = mBodies.at(i);
+		if (!Body.mIsStatic)
+		{
+			Body.mPosition = Body.mPosition.Add(Body.mVelocity.MultiplyScalar(DeltaTime));
+			Body.mRotation += Body.mAngularVelocity * DeltaTime;
+			UpdateBody(Body);
+		}
+	}
+
+	// Broadphase. Bodies hardly move between steps, so the sort has little to do.
+	std::sort(mSortedBodies.begin(), mSortedBodies.end(), [this](const int A, const int B)
+		{
+			return mBodies[A].mBox.mMin.x < mBodies[B].mBox.mMin.x;
+		});
+
+	for (int i = 0; i < mSortedBodies.size(); i++)
+	{
+		const int First = mSortedBodies[i];
+		const CollisionBody& FirstBody = mBodies[First];
+
+		for (int j = i + 1; j < mSortedBodies.size(); j++)
+		{
+			const int Second = mSortedBodies[j];
+			const CollisionBody& SecondBody = mBodies[Second];
+
+			// No more bodies can overlap along X
+			if (SecondBody.mBox.mMin.x > FirstBody.mBox.mMax.x)
+			{
+				break;
+			}
+
+			if ((FirstBody.mIsStatic && SecondBody.mIsStatic) || !FirstBody.mBox.Overlaps(SecondBody.mBox))
+			{
+				continue;
+			}
+
+			// Order by shape type, so each bucket of pairs in the narrowphase has one order of types
+			const bool bInOrder = FirstBody.mType < SecondBody.mType || (FirstBody.mType == SecondBody.mType && First < Second);
+			const int EntryIndex = bInOrder ? mPairCache.FindOrAdd(First, Second) : mPairCache.FindOrAdd(Second, First);
+			mPairCache.mEntries.mItems[EntryIndex].mLastFrame = mFrame;
+			mStats.mNumPairs++;
+		}
+	}
+
+	// Collect this step's pairs, and remove pairs the broadphase didn't find this time
+	int* Pairs = mArena.AllocateArray<int>(mStats.mNumPairs);
+	int NumPairs = 0;
+	for (int i = 0; i < mPairCache.mEntries.mItems.size(); i++)
+	{
+		const PairCacheEntry& Entry = mPairCache.mEntries.mItems[i];
+		if (!Entry.mInUse)
+		{
+			continue;
+		}
+
+		if (Entry.mLastFrame == mFrame)
+		{
+			Pairs[NumPairs++] = i;
+		}
+		else
+		{
+			mPairCache.Remove(i);
+		}
+	}
+
+	// Narrowphase. Pairs that are still separated on their cached axis are done,
+	// and the rest are sorted into buckets by shape types so each bucket runs through one test.
+	int BucketStarts[NumShapePairTypes + 1] = {};
+	for (int i = 0; i < NumPairs; i++)
+	{
+		const PairCacheEntry& Entry = mPairCache.mEntries.mItems[Pairs[i]];
+		const CollisionBody& FirstBody = mBodies[Entry.mFirstBody];
+		const CollisionBody& SecondBody = mBodies[Entry.mSecondBody];
+
+		// A pair that was separated last step is usually still separated on the same axis
+		if (Entry.mHasSeparatingAxis)
+		{
+			float Min1, Max1, Min2, Max2;
+			ProjectBody(FirstBody, Entry.mData.mSeparatingAxis, Min1, Max1);
+			ProjectBody(SecondBody, Entry.mData.mSeparatingAxis, Min2, Max2);
+
+			if (Max1 < Min2 || Max2 < Min1)
+			{
+				mStats.mNumCachedAxisRejects++;
+				Pairs[i] = -1;
+				continue;
+			}
+		}
+
+		BucketStarts[FirstBody.mType * eNumShapeTypes + SecondBody.mType + 1]++;
+	}
+
+	for (int i = 0; i < NumShapePairTypes; i++)
+	{
+		BucketStarts[i + 1] += BucketStarts[i];
+	}
+
+	int* BucketedPairs = mArena.AllocateArray<int>(BucketStarts[NumShapePairTypes]);
+	int BucketEnds[NumShapePairTypes];
+	std::copy(BucketStarts, BucketStarts + NumShapePairTypes, BucketEnds);
+
+	for (int i = 0; i < NumPairs; i++)
+	{
+		if (Pairs[i] != -1)
+		{
+			const PairCacheEntry& Entry = mPairCache.mEntries.mItems[Pairs[i]];
+			BucketedPairs[BucketEnds[mBodies[Entry.mFirstBody].mType * eNumShapeTypes + mBodies[Entry.mSecondBody].mType]++] = Pairs[i];
+		}
+	}
+
+	for (int i = 0; i < NumShapePairTypes; i++)
+	{
+		if (BucketStarts[i + 1] > BucketStarts[i])
+		{
+			PairBucketTable[i](*this, BucketedPairs + BucketStarts[i], BucketStarts[i + 1] - BucketStarts[i]);
+		}
+	}
+
+	mArena.Reset();
+}
+
+// Calls the test for the two bodies' shape types, from the table made at compile time.
+// Collision Data is updated with the normal pointing from the Second body to the First.
+bool CollisionWorld::CollideBodies(const int FirstBody, const int SecondBody, CollisionData& Data)
+{
+	const CollisionBody& First = mBodies.at(FirstBody);
+	const CollisionBody& Second = mBodies.at(SecondBody);
+	return PairTestTable[First.mType * eNumShapeTypes + Second.mType](*this, First, Second, Data);
+}
+
+// Keeps the result of testing a pair for the next step, and resolves it if they collide.
+void CollisionWorld::StorePairResult(PairCacheEntry& Entry, const bool bColliding, const CollisionData& Data)
+{
+	Entry.mIsColliding = bColliding;
+	Entry.mHasSeparatingAxis = !bColliding && (Data.mSeparatingAxis.x != 0.0f || Data.mSeparatingAxis.y != 0.0f);
+	Entry.mData = Data;
+
+	if (Data.mPolygonLevel != eLevelNone)
+	{
+		mStats.mNumPolygonTests[Data.mPolygonLevel]++;
+	}
+
+	if (bColliding)
+	{
+		mStats.mNumCollisions++;
+		ResolveCollision(mBodies[Entry.mFirstBody], mBodies[Entry.mSecondBody], Data);
+	}
+}
+
+// Projects the body's shape onto the axis, using the projection for its shape type.
+void CollisionWorld::ProjectBody(const CollisionBody& Body, const Vector2& Axis, float& Min, float& Max) const
+{
+	const Vector2 WorldAxes[SquareNumAxesToCheck] = { { 1.0f, 0.0f }, { 0.0f, 1.0f } };
+
+	switch (Body.mType)
+	{
+	case eShapeCircle:
+		GetMinMaxVertexOnAxisCircle(Axis, mCircles.at(Body.mShapeIndex), Min, Max);
+		break;
+	case eShapePolygon:
+		GetMinMaxVertexOnAxisShape(Axis, mPolygons.at(Body.mShapeIndex), Min, Max);
+		break;
+	case eShapeAABB:
+		GetMinMaxOnAxisBox(Axis, mAABBs.at(Body.mShapeIndex).mCentrePosition, WorldAxes, mAABBs.at(Body.mShapeIndex).mHalfSize, Min, Max);
+		break;
+	case eShapeOBB:
+		GetMinMaxOnAxisBox(Axis, mOBBs.at(Body.mShapeIndex).mCentrePosition, mOBBs.at(Body.mShapeIndex).mAxes, mOBBs.at(Body.mShapeIndex).mHalfSize, Min, Max);
+		break;
+	case eShapeCapsule:
+		GetMinMaxOnAxisCapsule(Axis, mCapsules.at(Body.mShapeIndex), Min, Max);
+		break;
+	default:
+		Min = 0.0f;
+		Max = 0.0f;
+		break;
+	}
+}
+
+// Pushes the bodies apart along the normal (split between them if both are dynamic),
+// and bounces any body moving into the other.
+void CollisionWorld::ResolveCollision(CollisionBody& First, CollisionBody& Second, const CollisionData& Data)
+{
+	const Vector2 Push = Data.mNormal.MultiplyScalar(Data.mPenetration);
+
+	if (First.mIsStatic)
+	{
+		Second.mPosition = Second.mPosition.Subtract(Push);
+	}
+	else if (Second.mIsStatic)
+	{
+		First.mPosition = First.mPosition.Add(Push);
+	}
+	else
+	{
+		First.mPosition = First.mPosition.Add(Push.MultiplyScalar(0.5f));
+		Second.mPosition = Second.mPosition.Subtract(Push.MultiplyScalar(0.5f));
+	}
+
+	// The normal points from the second body to the first
+	const float FirstSpeed = First.mVelocity.DotProduct(Data.mNormal);
+	if (!First.mIsStatic && FirstSpeed < 0.0f)
+	{
+		First.mVelocity = First.mVelocity.Subtract(Data.mNormal.MultiplyScalar(2.0f * FirstSpeed));
+	}
+
+	const float SecondSpeed = Second.mVelocity.DotProduct(Data.mNormal);
+	if (!Second.mIsStatic && SecondSpeed > 0.0f)
+	{
+		Second.mVelocity = Second.mVelocity.Subtract(Data.mNormal.MultiplyScalar(2.0f * SecondSpeed));
+	}
+
+	if (!First.mIsStatic)
+	{
+		UpdateBody(First);
+	}
+	if (!Second.mIsStatic)
+	{
+		UpdateBody(Second);
+	}
+}
+
+// Runs the collision world without the engine, with the demo's obstacles and lots of moving shapes.
+// Reports how long a step takes, and how many allocations the steps made once the pools had warmed up (should be none).
+// Then times batches of raycasts and shape casts against where the shapes ended up, and checks they find the same hits as testing every body.
+// Last, checks the polygon levels of detail against the exact SAT.
+// Returns false if any check failed, so a script running it can tell.
+bool RunHeadlessWorld()
+{
+	CollisionWorld World;
+	std::mt19937 Random(1);
+	std::uniform_real_distribution<float> Position(-HeadlessHalfArea + 20.0f, HeadlessHalfArea - 20.0f);
+	std::uniform_real_distribution<float> Speed(-MoveSpeed * 4.0f, MoveSpeed * 4.0f);
+	std::uniform_real_distribution<float> Size(2.0f, 6.0f);
+
+	// Walls around the area
+	AABB Wall;
+	Wall.InitialiseAABB(nullptr, nullptr, { HeadlessHalfArea, 10.0f });
+	World.AddBody(Wall, { 0.0f, HeadlessHalfArea + 10.0f }, 0.0f, true);
+	World.AddBody(Wall, { 0.0f, -HeadlessHalfArea - 10.0f }, 0.0f, true);
+	Wall.InitialiseAABB(nullptr, nullptr, { 10.0f, HeadlessHalfArea });
+	World.AddBody(Wall, { HeadlessHalfArea + 10.0f, 0.0f }, 0.0f, true);
+	World.AddBody(Wall, { -HeadlessHalfArea - 10.0f, 0.0f }, 0.0f, true);
+
+	// Fixed in place shapes, like the demo's background shapes
+	for (int i = 0; i < 10; i++)
+	{
+		Polygon Obstacle;
+		Obstacle.InitialiseShape(nullptr, nullptr, i + 3, 10.0f);
+		World.AddBody(Obstacle, { i * 40.0f - 180.0f, 0.0f }, 0.0f, true);
+	}
+
+	// Moving shapes of every type. Every other polygon has many sides, so is nearly a circle.
+	for (int i = 0; i < HeadlessNumDynamicBodies; i++)
+	{
+		int Body;
+		const Vector2 StartPosition = { Position(Random), Position(Random) };
+
+		switch (i % eNumShapeTypes)
+		{
+		case eShapeCircle:
+		{
+			Circle NewCircle;
+			NewCircle.InitialiseCircle(nullptr, Size(Random));
+			Body = World.AddBody(NewCircle, StartPosition, 0.0f, false);
+			break;
+		}
+		case eShapePolygon:
+		{
+			Polygon NewPolygon;
+			const int NumSides = (i / eNumShapeTypes) % 2 == 0 ? 3 + i % 6 : 12 + i % 21;
+			NewPolygon.InitialiseShape(nullptr, nullptr, NumSides, Size(Random));
+			Body = World.AddBody(NewPolygon, StartPosition, 0.0f, false);
+			break;
+		}
+		case eShapeAABB:
+		{
+			AABB NewAABB;
+			NewAABB.InitialiseAABB(nullptr, nullptr, { Size(Random), Size(Random) });
+			Body = World.AddBody(NewAABB, StartPosition, 0.0f, false);
+			break;
+		}
+		case eShapeOBB:
+		{
+			OBB NewOBB;
+			NewOBB.InitialiseOBB(nullptr, nullptr, { Size(Random), Size(Random) });
+			Body = World.AddBody(NewOBB, StartPosition, 0.0f, false);
+			break;
+		}
+		default:
+		{
+			Capsule NewCapsule;
+			NewCapsule.InitialiseCapsule(nullptr, nullptr, Size(Random), 0.5f * Size(Random));
+			Body = World.AddBody(NewCapsule, StartPosition, 0.0f, false);
+			break;
+		}
+		}
+
+		World.mBodies.at(Body).mVelocity = { Speed(Random), Speed(Random) };
+		World.mBodies.at(Body).mAngularVelocity = RotateSpeed;
+	}
+
+	World.mPairCache.Reserve(HeadlessPairsPerBody * static_cast<int>(World.mBodies.size()));
+
+	// Let the pools and arena grow to the size they need
+	for (int i = 0; i < HeadlessNumWarmUpSteps; i++)
+	{
+		World.Step(HeadlessDeltaTime);
+	}
+
+	long long NumCollisions = 0;
+	long long NumPolygonTests[eNumPolygonLevels] = {};
+	const long long AllocationsAtStart = NumHeapAllocations;
+	const auto StartTime = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < HeadlessNumTimedSteps; i++)
+	{
+		World.Step(HeadlessDeltaTime);
+		NumCollisions += World.mStats.mNumCollisions;
+		for (int Level = 0; Level < eNumPolygonLevels; Level++)
+		{
+			NumPolygonTests[Level] += World.mStats.mNumPolygonTests[Level];
+		}
+	}
+
+	const std::chrono::duration<double, std::milli> Time = std::chrono::steady_clock::now() - StartTime;
+	const long long NumAllocations = NumHeapAllocations - AllocationsAtStart;
+	bool bPassed = true;
+
+	std::cout << "Headless world: " << World.mBodies.size() << " bodies, " << HeadlessNumTimedSteps << " steps" << std::endl;
+	std::cout << "Average step time: " << Time.count() / HeadlessNumTimedSteps << " ms" << std::endl;
+	std::cout << "Average collisions per step: " << NumCollisions / HeadlessNumTimedSteps << std::endl;
+	std::cout << "Pairs last step: " << World.mStats.mNumPairs << " (" << World.mStats.mNumCachedAxisRejects << " rejected by cached axis)" << std::endl;
+	PrintPolygonTests(NumPolygonTests, HeadlessNumTimedSteps);
+	std::cout << "Allocations after warm up: " << NumAllocations << (NumAllocations == 0 ? "" : " - FAILED, should be 0") << std::endl;
+	bPassed = bPassed && NumAllocations == 0;
+
+	// Queries from random places in random directions
+	const int NumThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	World.InitialiseWorkers(NumThreads);
+	std::uniform_real_distribution<float> Angle(0.0f, 360.0f);
+
+	std::vector<RayQuery> Rays(HeadlessNumRays);
+	for (int i = 0; i < HeadlessNumRays; i++)
+	{
+		const float Radians = Angle(Random) * DegreesToRadians;
+		const Vector2 Direction = { cosf(Radians), sinf(Radians) };
+		Rays.at(i) = { { Position(Random), Position(Random) }, Direction, HeadlessQueryDistance, -1 };
+	}
+
+	std::vector<Polygon> CastShapes(HeadlessNumShapeCasts);
+	std::vector<ShapeCastQuery> Casts(HeadlessNumShapeCasts);
+	for (int i = 0; i < HeadlessNumShapeCasts; i++)
+	{
+		const float Radians = Angle(Random) * DegreesToRadians;
+		const Vector2 Direction = { cosf(Radians), sinf(Radians) };
+		CastShapes.at(i).InitialiseShape(nullptr, nullptr, 3 + i % 4, Size(Random));
+		CastShapes.at(i).SetTransform({ Position(Random), Position(Random) }, Direction.x, Direction.y);
+		Casts.at(i) = { &CastShapes.at(i), Direction, HeadlessQueryDistance, -1 };
+	}
+
+	std::vector<QueryHit> RayHits(HeadlessNumRays);
+	std::vector<QueryHit> CastHits(HeadlessNumShapeCasts);
+
+	// First batch wakes the workers up
+	World.RaycastBatch(Rays.data(), HeadlessNumRays, RayHits.data());
+	World.ShapeCastBatch(Casts.data(), HeadlessNumShapeCasts, CastHits.data());
+
+	auto QueryStartTime = std::chrono::steady_clock::now();
+	for (int i = 0; i < HeadlessNumQueryRepeats; i++)
+	{
+		World.RaycastBatch(Rays.data(), HeadlessNumRays, RayHits.data());
+	}
+	const std::chrono::duration<double, std::milli> RayTime = std::chrono::steady_clock::now() - QueryStartTime;
+
+	QueryStartTime = std::chrono::steady_clock::now();
+	for (int i = 0; i < HeadlessNumQueryRepeats; i++)
+	{
+		World.ShapeCastBatch(Casts.data(), HeadlessNumShapeCasts, CastHits.data());
+	}
+	const std::chrono::duration<double, std::milli> CastTime = std::chrono::steady_clock::now() - QueryStartTime;
+
+	// Check against testing every body
+	int NumRayHits = 0;
+	int NumRayMismatches = 0;
+	for (int i = 0; i < HeadlessNumRays; i++)
+	{
+		QueryHit Expected;
+		float NextDistance;
+		World.RaycastAllBodies(Rays.at(i), Expected, NextDistance);
+		NumRayHits += (RayHits.at(i).mBody != -1);
+		NumRayMismatches += !SameQueryHit(RayHits.at(i), Expected, NextDistance);
+	}
+
+	int NumCastHits = 0;
+	int NumCastMismatches = 0;
+	for (int i = 0; i < HeadlessNumShapeCasts; i++)
+	{
+		QueryHit Expected;
+		float NextDistance;
+		World.ShapeCastAllBodies(Casts.at(i), Expected, NextDistance);
+		NumCastHits += (CastHits.at(i).mBody != -1);
+		NumCastMismatches += !SameQueryHit(CastHits.at(i), Expected, NextDistance);
+	}
+
+	const double RayBatchTime = RayTime.count() / HeadlessNumQueryRepeats;
+	const double CastBatchTime = CastTime.count() / HeadlessNumQueryRepeats;
+	std::cout << "Raycasts: " << HeadlessNumRays << " in " << RayBatchTime << " ms (" << NumRayHits << " hit, " << NumThreads << " threads), target "
+		<< HeadlessRayTargetTime << " ms" << (RayBatchTime < HeadlessRayTargetTime ? "" : " - FAILED, too slow") << std::endl;
+	std::cout << "Shape casts: " << HeadlessNumShapeCasts << " in " << CastBatchTime << " ms (" << NumCastHits << " hit, " << NumThreads << " threads), target "
+		<< HeadlessShapeCastTargetTime << " ms" << (CastBatchTime < HeadlessShapeCastTargetTime ? "" : " - FAILED, too slow") << std::endl;
+	bPassed = bPassed && RayBatchTime < HeadlessRayTargetTime && CastBatchTime < HeadlessShapeCastTargetTime;
+
+	std::cout << "Queries differing from testing every body: " << NumRayMismatches << " raycasts, " << NumCastMismatches << " shape casts"
+		<< (NumRayMismatches + NumCastMismatches == 0 ? "" : " - FAILED, should be 0") << std::endl;
+	bPassed = bPassed && NumRayMismatches + NumCastMismatches == 0;
+
+	bPassed = CheckPolygonLevels(Random) && bPassed;
+
+	return bPassed;
+}
+
+// Prints how many tests between two polygons each level of detail decided, per step and as a percentage.
+void PrintPolygonTests(const long long NumPolygonTests[eNumPolygonLevels], const long long NumSteps)
+{
+	long long NumTests = 0;
+	for (int Level = 0; Level < eNumPolygonLevels; Level++)
+	{
+		NumTests += NumPolygonTests[Level];
+	}
+
+	std::cout << "Polygon tests per step decided by:";
+	for (int Level = 0; Level < eNumPolygonLevels; Level++)
+	{
+		std::cout << (Level == 0 ? " " : ", ") << PolygonLevelNames[Level] << " " << static_cast<double>(NumPolygonTests[Level]) / NumSteps
+			<< " (" << (NumTests > 0 ? 100 * NumPolygonTests[Level] / NumTests : 0) << "%)";
+	}
+	std::cout << std::endl;
+}
+
+// Tests random pairs of polygons, from triangles to nearly circles, with TwoShapesSAT and with the exact SAT, and prints how many differ.
+// The levels of detail must give the same result as the exact polygons. A separating axis they report must separate the exact polygons,
+// and a contact must have the same depth and normal. Returns false if any differ.
+bool CheckPolygonLevels(std::mt19937& Random)
+{
+	const int NumPolygons = 64;
+	std::vector<Polygon> Polygons(NumPolygons);
+	for (int i = 0; i < NumPolygons; i++)
+	{
+		Polygons.at(i).InitialiseShape(nullptr, nullptr, 3 + (i * 7) % 40, 1.0f + i % 5);
+	}
+
+	// Polygons from points, one with many corners
+	std::vector<Vector2> Points;
+	for (int i = 0; i < 40; i++)
+	{
+		Points.push_back({ 6.0f * cosf(i * 9.0f * DegreesToRadians) + 1.0f, 4.0f * sinf(i * 9.0f * DegreesToRadians) + 0.5f });
+	}
+	Polygons.at(0) = Polygon();
+	Polygons.at(0).InitialiseFromPoints(nullptr, nullptr, Points);
+
+	std::uniform_int_distribution<int> Pick(0, NumPolygons - 1);
+	std::uniform_int_distribution<int> PickOther(1, NumPolygons - 1);
+	std::uniform_real_distribution<float> Angle(0.0f, 360.0f);
+	std::uniform_real_distribution<float> Distance(0.0f, 1.2f);
+	int NumMismatches = 0;
+
+	for (int i = 0; i < HeadlessNumPolygonChecks; i++)
+	{
+		const int FirstIndex = Pick(Random);
+		Polygon& First = Polygons.at(FirstIndex);
+		Polygon& Second = Polygons.at((FirstIndex + PickOther(Random)) % NumPolygons);
+
+		// Second is placed up to a little beyond where the outer circles touch, so every level decides some tests
+		const float FirstRadians = Angle(Random) * DegreesToRadians;
+		const float SecondRadians = Angle(Random) * DegreesToRadians;
+		const float PlaceRadians = Angle(Random) * DegreesToRadians;
+		const float PlaceDistance = Distance(Random) * (First.mOuterRadius + Second.mOuterRadius);
+		First.SetTransform({ 0.0f, 0.0f }, cosf(FirstRadians), sinf(FirstRadians));
+		Second.SetTransform({ PlaceDistance * cosf(PlaceRadians), PlaceDistance * sinf(PlaceRadians) }, cosf(SecondRadians), sinf(SecondRadians));
+
+		CollisionData Data;
+		Data.InitialiseData();
+		const bool bColliding = TwoShapesSAT(First, Second, Data);
+
+		CollisionData ExactData;
+		ExactData.InitialiseData();
+		const bool bExactColliding = TwoShapesExactSAT(First, Second, ExactData);
+
+		bool bMatches = bColliding == bExactColliding;
+		if (bMatches && !bColliding)
+		{
+			float Min1, Max1, Min2, Max2;
+			GetMinMaxVertexOnAxisShape(Data.mSeparatingAxis, First, Min1, Max1);
+			GetMinMaxVertexOnAxisShape(Data.mSeparatingAxis, Second, Min2, Max2);
+			bMatches = Max1 < Min2 || Max2 < Min1;
+		}
+		else if (bMatches)
+		{
+			bMatches = Data.mPenetration == ExactData.mPenetration && Data.mNormal.x == ExactData.mNormal.x && Data.mNormal.y == ExactData.mNormal.y;
+		}
+
+		NumMismatches += !bMatches;
+	}
+
+	std::cout << "Polygon tests differing from the exact SAT: " << NumMismatches << " of " << HeadlessNumPolygonChecks
+		<< (NumMismatches == 0 ? "" : " - FAILED, should be 0") << std::endl;
+	return NumMismatches == 0;
+}
+
+// Starts NumThreads - 1 worker threads, as the thread calling Run is the other one.
+void WorkerPool::Initialise(const int NumThreads)
+{
+	Shutdown();
+
+	mStopping = false;
+	for (int i = 1; i < NumThreads; i++)
+	{
+		mThreads.emplace_back(&WorkerPool::WorkerLoop, this, mJobNumber);
+	}
+}
+
+// Stops and joins all worker threads.
+void WorkerPool::Shutdown()
+{
+	{
+		std::lock_guard<std::mutex> Lock(mMutex);
+		mStopping = true;
+	}
+	mJobReady.notify_all();
+
+	for (int i = 0; i < mThreads.size(); i++)
+	{
+		mThreads.at(i).join();
+	}
+	mThreads.clear();
+}
+
+WorkerPool::~WorkerPool()
+{
+	Shutdown();
+}
+
+// Runs Job on every chunk of the items and returns when all are done.
+void WorkerPool::Run(void (*Job)(void* Context, const int First, const int Last), void* Context, const int NumItems, const int ChunkSize)
+{
+	if (mThreads.empty())
+	{
+		Job(Context, 0, NumItems);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> Lock(mMutex);
+		mJob = Job;
+		mJobContext = Context;
+		mNumItems = NumItems;
+		mChunkSize = ChunkSize;
+		mNextItem = 0;
+		mNumWorking = static_cast<int>(mThreads.size());
+		mJobNumber++;
+	}
+	mJobReady.notify_all();
+
+	RunChunks();
+
+	std::unique_lock<std::mutex> Lock(mMutex);
+	mJobDone.wait(Lock, [this]() { return mNumWorking == 0; });
+}
+
+// Takes chunks of the current job until there are none left.
+void WorkerPool::RunChunks()
+{
+	int First = mNextItem.fetch_add(mChunkSize);
+	while (First < mNumItems)
+	{
+		mJob(mJobContext, First, std::min(First + mChunkSize, mNumItems));
+		First = mNextItem.fetch_add(mChunkSize);
+	}
+}
+
+// Worker threads wait here for the next job. StartJobNumber is the last job before the thread started,
+// so a thread started by Initialising the pool again doesn't take part in a job that has already finished.
+void WorkerPool::WorkerLoop(const int StartJobNumber)
+{
+	int LastJobNumber = StartJobNumber;
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> Lock(mMutex);
+			mJobReady.wait(Lock, [this, LastJobNumber]() { return mStopping || mJobNumber != LastJobNumber; });
+			if (mStopping)
+			{
+				return;
+			}
+			LastJobNumber = mJobNumber;
+		}
+
+		RunChunks();
+
+		{
+			std::lock_guard<std::mutex> Lock(mMutex);
+			mNumWorking--;
+		}
+		mJobDone.notify_one();
+	}
+}
+
+// Narrows the range of distances [Enter, Exit] along the motion where the moving interval (Min1, Max1) overlaps
+// the fixed interval (Min2, Max2) on this axis. Speed is how fast the moving interval moves along the axis.
+// If the interval enters later than Enter, Normal is set to the axis facing the moving shape.
+// Returns false if they can't overlap in the range, so the shapes don't hit.
+bool SweepIntervalOnAxis(const Vector2& Axis, const float& Min1, const float& Max1, const float& Speed, const float& Min2, const float& Max2,
+	float& Enter, float& Exit, Vector2& Normal)
+{
+	// Moving along the side of the axis doesn't change the overlap
+	if (fabs(Speed) < SweepParallelTolerance)
+	{
+		return (Min1 <= Min2 && Max1 >= Min2) || (Min2 <= Min1 && Max2 >= Min1);
+	}
+
+	float Start = (Min2 - Max1) / Speed;
+	float End = (Max2 - Min1) / Speed;
+	if (Start > End)
+	{
+		std::swap(Start, End);
+	}
+
+	if (Start > Enter)
+	{
+		Enter = Start;
+		Normal = Axis.MultiplyScalar(Speed > 0.0f ? -1.0f : 1.0f);
+	}
+	Exit = std::min(Exit, End);
+
+	return Enter <= Exit;
+}
+
+// Distance along the ray (Direction must be normalised) to the circle. Starting inside counts as a hit at 0.
+bool RayToCircle(const Vector2& Origin, const Vector2& Direction, const float MaxDistance, const Vector2& Centre, const float Radius,
+	float& Distance, Vector2& Normal)
+{
+	const Vector2 CentreToOrigin = Origin.Subtract(Centre);
+	const float B = CentreToOrigin.DotProduct(Direction);
+	const float C = CentreToOrigin.DotProduct(CentreToOrigin) - Radius * Radius;
+
+	if (C <= 0.0f)
+	{
+		Distance = 0.0f;
+		Normal = Direction.MultiplyScalar(-1.0f);
+		return true;
+	}
+
+	// Starts outside and moving away, or misses
+	const float Discriminant = B * B - C;
+	if (B > 0.0f || Discriminant < 0.0f)
+	{
+		return false;
+	}
+
+	const float HitDistance = -B - sqrt(Discriminant);
+	if (HitDistance > MaxDistance)
+	{
+		return false;
+	}
+
+	Distance = HitDistance;
+	Normal = Origin.Add(Direction.MultiplyScalar(HitDistance)).Subtract(Centre).MultiplyScalar(1.0f / Radius);
+	return true;
+}
+
+// Distance the polygon moves along Direction (must be normalised) before it hits the circle. The circle's centre hits
+// the polygon grown by the radius, which is the polygon, a circle at each vertex and a box along each side, so a ray from
+// the centre the other way is tested against each of them. Starting inside counts as a hit at 0.
+bool PolygonCastToCircle(const Polygon& CastShape, const Vector2& Direction, const float MaxDistance, const Vector2& Centre, const float Radius,
+	float& Distance, Vector2& Normal)
+{
+	const std::vector<Vector2>& Vertices = CastShape.mVerticesPositions;
+	const Vector2 Reverse = Direction.MultiplyScalar(-1.0f);
+
+	// Centre inside the polygon
+	bool bInside = true;
+	for (int i = 0; i < CastShape.mAxes.size() && bInside; i++)
+	{
+		float Min, Max;
+		GetMinMaxVertexOnAxisShape(CastShape.mAxes[i], CastShape, Min, Max);
+		const float CentreOnAxis = Centre.DotProduct(CastShape.mAxes[i]);
+		bInside = CentreOnAxis >= Min && CentreOnAxis <= Max;
+	}
+	if (bInside)
+	{
+		Distance = 0.0f;
+		Normal = Reverse;
+		return true;
+	}
+
+	bool bHit = false;
+	float BestDistance = MaxDistance;
+	float HitDistance;
+	Vector2 HitNormal;
+
+	for (int i = 0; i < Vertices.size(); i++)
+	{
+		// Circle at the vertex. Its normal faces the circle's centre, so the body's faces the other way
+		if (RayToCircle(Centre, Reverse, BestDistance, Vertices[i], Radius, HitDistance, HitNormal))
+		{
+			BestDistance = HitDistance;
+			Normal = HitNormal.MultiplyScalar(-1.0f);
+			bHit = true;
+		}
+
+		// Box along the side to the next vertex
+		const Vector2& NextVertex = Vertices[(i + 1) % Vertices.size()];
+		Vector2 SideAxes[SquareNumAxesToCheck] = { NextVertex.Subtract(Vertices[i]) };
+		const Vector2 SideHalfSize = { 0.5f * SideAxes[0].Length(), Radius };
+		SideAxes[0].Normalise();
+		SideAxes[1] = SideAxes[0].PerpendicularVector();
+		const Vector2 SideCentre = Vertices[i].Add(NextVertex).MultiplyScalar(0.5f);
+
+		float Enter = 0.0f;
+		float Exit = BestDistance;
+		Vector2 SideNormal = { 0.0f, 0.0f };
+		bool bSideHit = true;
+		for (int j = 0; j < SquareNumAxesToCheck && bSideHit; j++)
+		{
+			float Min, Max;
+			GetMinMaxOnAxisBox(SideAxes[j], SideCentre, SideAxes, SideHalfSize, Min, Max);
+			const float CentreOnAxis = Centre.DotProduct(SideAxes[j]);
+			bSideHit = SweepIntervalOnAxis(SideAxes[j], CentreOnAxis, CentreOnAxis, Reverse.DotProduct(SideAxes[j]), Min, Max, Enter, Exit, SideNormal);
+		}
+
+		if (bSideHit && (!bHit || Enter < BestDistance))
+		{
+			BestDistance = Enter;
+			Normal = (SideNormal.x == 0.0f && SideNormal.y == 0.0f) ? Reverse : SideNormal.MultiplyScalar(-1.0f);
+			bHit = true;
+		}
+	}
+
+	Distance = BestDistance;
+	return bHit;
+}
+
+// Distance Point moves along Direction (must be normalised) before it comes within Radius of the side from A to B,
+// up to MaxDistance. Point must start further away than Radius. Normal faces from the side towards the point.
+bool PointCastToRoundedSide(const Vector2& Point, const Vector2& Direction, const Vector2& A, const Vector2& B, const float Radius,
+	const float MaxDistance, float& Distance, Vector2& Normal)
+{
+	bool bHit = false;
+	float BestDistance = MaxDistance;
+
+	// Flat part, Radius out from the side towards the point
+	const Vector2 Side = B.Subtract(A);
+	const float SideLengthSquared = Side.DotProduct(Side);
+	Vector2 SideNormal = Side.PerpendicularVector();
+	const float Approach = SideNormal.DotProduct(Direction);
+	if (SideLengthSquared > 0.0f && Approach != 0.0f)
+	{
+		SideNormal = SideNormal.MultiplyScalar((Approach > 0.0f ? -1.0f : 1.0f) / sqrt(SideLengthSquared));
+		const float HitDistance = (Radius - Point.Subtract(A).DotProduct(SideNormal)) / Direction.DotProduct(SideNormal);
+		const float Along = Point.Add(Direction.MultiplyScalar(HitDistance)).Subtract(A).DotProduct(Side);
+
+		if (HitDistance >= 0.0f && HitDistance <= BestDistance && Along >= 0.0f && Along <= SideLengthSquared)
+		{
+			BestDistance = HitDistance;
+			Normal = SideNormal;
+			bHit = true;
+		}
+	}
+
+	// Round ends
+	const Vector2 Ends[2] = { A, B };
+	for (int i = 0; i < 2 && Radius > 0.0f; i++)
+	{
+		const Vector2 EndToPoint = Point.Subtract(Ends[i]);
+		const float Along = EndToPoint.DotProduct(Direction);
+		const float ClosestSquared = EndToPoint.DotProduct(EndToPoint) - Along * Along;
+		if (Along >= 0.0f || ClosestSquared > Radius * Radius)
+		{
+			continue;
+		}
+
+		const float HitDistance = -Along - sqrt(Radius * Radius - ClosestSquared);
+		if (HitDistance >= 0.0f && HitDistance <= BestDistance)
+		{
+			BestDistance = HitDistance;
+			Normal = Point.Add(Direction.MultiplyScalar(HitDistance)).Subtract(Ends[i]).MultiplyScalar(1.0f / Radius);
+			bHit = true;
+		}
+	}
+
+	Distance = BestDistance;
+	return bHit;
+}
+
+// Distance from the point to the outline, a convex polygon, a side or a single point. 0 if inside a polygon.
+float PointToOutlineDistance(const Vector2& Point, const std::vector<Vector2>& Corners)
+{
+	float Closest = FLT_MAX;
+	bool bLeftOfSide = false;
+	bool bRightOfSide = false;
+
+	for (int i = 0; i < Corners.size(); i++)
+	{
+		const Vector2 Side = Corners[(i + 1) % Corners.size()].Subtract(Corners[i]);
+		const Vector2 ToPoint = Point.Subtract(Corners[i]);
+		const float SideLengthSquared = Side.DotProduct(Side);
+		const float Along = (SideLengthSquared > 0.0f) ? std::clamp(ToPoint.DotProduct(Side) / SideLengthSquared, 0.0f, 1.0f) : 0.0f;
+		const Vector2 Offset = ToPoint.Subtract(Side.MultiplyScalar(Along));
+		Closest = std::min(Closest, static_cast<float>(sqrt(Offset.DotProduct(Offset))));
+
+		const float Cross = Side.x * ToPoint.y - Side.y * ToPoint.x;
+		bLeftOfSide = bLeftOfSide || Cross > 0.0f;
+		bRightOfSide = bRightOfSide || Cross < 0.0f;
+	}
+
+	return (Corners.size() >= 3 && !(bLeftOfSide && bRightOfSide)) ? 0.0f : Closest;
+}
+
+// Returns whether the side from A to B crosses the side from C to D.
+bool SidesCross(const Vector2& A, const Vector2& B, const Vector2& C, const Vector2& D)
+{
+	const Vector2 AB = B.Subtract(A);
+	const Vector2 CD = D.Subtract(C);
+	const float SideOfC = AB.x * (C.y - A.y) - AB.y * (C.x - A.x);
+	const float SideOfD = AB.x * (D.y - A.y) - AB.y * (D.x - A.x);
+	const float SideOfA = CD.x * (A.y - C.y) - CD.y * (A.x - C.x);
+	const float SideOfB = CD.x * (B.y - C.y) - CD.y * (B.x - C.x);
+
+	return (SideOfC > 0.0f) != (SideOfD > 0.0f) && (SideOfA > 0.0f) != (SideOfB > 0.0f);
+}
+
+// Distance the cast outline (a convex polygon, or a single point for a ray) moves along Direction before it comes within Radius
+// of the body's outline (a convex polygon, a side for capsules or a point for circles), up to MaxDistance.
+// Used to check the queries, so it is built from the outlines rather than the swept SAT the queries use. Convex outlines
+// first touch where a corner of one meets a side of the other, so every corner is cast against every side of the other.
+bool OutlineCastToOutline(const std::vector<Vector2>& CastCorners, const Vector2& Direction, const std::vector<Vector2>& Corners, const float Radius,
+	const float MaxDistance, float& Distance, Vector2& Normal)
+{
+	// Starts overlapping if a corner of either is within Radius of the other, or their sides cross
+	bool bOverlapping = false;
+	for (int i = 0; i < CastCorners.size() && !bOverlapping; i++)
+	{
+		bOverlapping = PointToOutlineDistance(CastCorners[i], Corners) <= Radius;
+	}
+	for (int i = 0; i < Corners.size() && !bOverlapping; i++)
+	{
+		bOverlapping = PointToOutlineDistance(Corners[i], CastCorners) <= Radius;
+	}
+	for (int i = 0; i < CastCorners.size() && !bOverlapping; i++)
+	{
+		for (int j = 0; j < Corners.size() && !bOverlapping; j++)
+		{
+			bOverlapping = SidesCross(CastCorners[i], CastCorners[(i + 1) % CastCorners.size()], Corners[j], Corners[(j + 1) % Corners.size()]);
+		}
+	}
+
+	if (bOverlapping)
+	{
+		Distance = 0.0f;
+		Normal = Direction.MultiplyScalar(-1.0f);
+		return true;
+	}
+
+	bool bHit = false;
+	float BestDistance = MaxDistance;
+	float HitDistance;
+	Vector2 HitNormal;
+
+	// Cast corners moving onto the body's sides
+	for (int i = 0; i < CastCorners.size(); i++)
+	{
+		for (int j = 0; j < Corners.size(); j++)
+		{
+			if (PointCastToRoundedSide(CastCorners[i], Direction, Corners[j], Corners[(j + 1) % Corners.size()], Radius, BestDistance, HitDistance, HitNormal))
+			{
+				BestDistance = HitDistance;
+				Normal = HitNormal;
+				bHit = true;
+			}
+		}
+	}
+
+	// Body's corners moving the other way onto the cast sides. The normal faces the body's corner, so the body's faces the other way
+	const Vector2 Reverse = Direction.MultiplyScalar(-1.0f);
+	for (int i = 0; i < Corners.size(); i++)
+	{
+		for (int j = 0; j < CastCorners.size(); j++)
+		{
+			if (PointCastToRoundedSide(Corners[i], Reverse, CastCorners[j], CastCorners[(j + 1) % CastCorners.size()], Radius, BestDistance, HitDistance, HitNormal))
+			{
+				BestDistance = HitDistance;
+				Normal = HitNormal.MultiplyScalar(-1.0f);
+				bHit = true;
+			}
+		}
+	}
+
+	Distance = BestDistance;
+	return bHit;
+}
+
+// Resets Hit to no hit, as far as the query can reach.
+void InitialiseHit(QueryHit& Hit, const float MaxDistance)
+{
+	Hit.mBody = -1;
+	Hit.mDistance = MaxDistance;
+	Hit.mNormal = { 0.0f, 0.0f };
+}
+
+// Returns whether a query found the expected hit (the same body, distance and normal), or both found nothing.
+// NextDistance is the closest hit on any other body. If that is as close as the expected hit, either body could be found,
+// so the body and normal aren't compared.
+bool SameQueryHit(const QueryHit& Hit, const QueryHit& Expected, const float NextDistance)
+{
+	if (Hit.mBody == -1 || Expected.mBody == -1)
+	{
+		return Hit.mBody == Expected.mBody;
+	}
+	if (fabs(Hit.mDistance - Expected.mDistance) > QueryCheckTolerance)
+	{
+		return false;
+	}
+	if (Hit.mBody != Expected.mBody)
+	{
+		return NextDistance - Expected.mDistance <= QueryCheckTolerance;
+	}
+	return fabs(Hit.mNormal.x - Expected.mNormal.x) <= QueryCheckTolerance && fabs(Hit.mNormal.y - Expected.mNormal.y) <= QueryCheckTolerance;
+}
+
+// Starts the world's worker threads, used by the batched queries. NumThreads includes the calling thread.
+void CollisionWorld::InitialiseWorkers(const int NumThreads)
+{
+	mWorkers.Initialise(NumThreads);
+}
+
+// Bounding boxes of the bodies as separate arrays, 4 boxes at a time for SSE. Done once per step, before the first batch of queries.
+// Wide bodies (like walls) come first and are checked by every query. The rest follow in the order of the broadphase sort,
+// so a query only checks the ones near it along X.
+void CollisionWorld::PrepareQueries()
+{
+	// Bodies have moved since the broadphase sort, so the order may be a bit out
+	std::sort(mSortedBodies.begin(), mSortedBodies.end(), [this](const int A, const int B)
+		{
+			return mBodies[A].mBox.mMin.x < mBodies[B].mBox.mMin.x;
+		});
+
+	const int NumBodies = static_cast<int>(mSortedBodies.size());
+	float AverageWidth = 0.0f;
+	for (int i = 0; i < NumBodies; i++)
+	{
+		AverageWidth += (mBodies[i].mBox.mMax.x - mBodies[i].mBox.mMin.x) / NumBodies;
+	}
+	const float WideWidth = QueryWideBodyFactor * AverageWidth;
+
+	int NumWide = 0;
+	for (int i = 0; i < NumBodies; i++)
+	{
+		NumWide += (mBodies[i].mBox.mMax.x - mBodies[i].mBox.mMin.x > WideWidth);
+	}
+
+	mQueryNumWideSlots = (NumWide + QueryLanes - 1) / QueryLanes * QueryLanes;
+	mQueryFirstNarrow = mQueryNumWideSlots;
+	mQueryLastNarrow = mQueryNumWideSlots + NumBodies - NumWide;
+
+	const int NumSlots = mQueryNumWideSlots + (NumBodies - NumWide + QueryLanes - 1) / QueryLanes * QueryLanes;
+	mQueryMinX.resize(NumSlots);
+	mQueryMinY.resize(NumSlots);
+	mQueryMaxX.resize(NumSlots);
+	mQueryMaxY.resize(NumSlots);
+	mQueryBodies.resize(NumSlots);
+
+	// Empty slots fill the last 4 of each part. Queries skip them.
+	for (int i = 0; i < NumSlots; i++)
+	{
+		mQueryMinX[i] = FLT_MAX;
+		mQueryMinY[i] = FLT_MAX;
+		mQueryMaxX[i] = -FLT_MAX;
+		mQueryMaxY[i] = -FLT_MAX;
+		mQueryBodies[i] = -1;
+	}
+
+	int NextWide = 0;
+	int NextNarrow = mQueryFirstNarrow;
+	mQueryMaxWidth = 0.0f;
+
+	for (int i = 0; i < NumBodies; i++)
+	{
+		const BoundingBox& Box = mBodies[mSortedBodies[i]].mBox;
+		const float Width = Box.mMax.x - Box.mMin.x;
+		const int Slot = (Width > WideWidth) ? NextWide++ : NextNarrow++;
+
+		mQueryMinX[Slot] = Box.mMin.x;
+		mQueryMinY[Slot] = Box.mMin.y;
+		mQueryMaxX[Slot] = Box.mMax.x;
+		mQueryMaxY[Slot] = Box.mMax.y;
+		mQueryBodies[Slot] = mSortedBodies[i];
+
+		if (Width <= WideWidth)
+		{
+			mQueryMaxWidth = std::max(mQueryMaxWidth, Width);
+		}
+	}
+
+	mQueryFrame = mFrame;
+}
+
+// Range of narrow query slots (in 4s) that can overlap MinX to MaxX. As the boxes are sorted by their left,
+// only boxes starting between MinX minus the widest box and MaxX need checking.
+void CollisionWorld::GetQueryRange(const float MinX, const float MaxX, int& First, int& Last) const
+{
+	const auto Begin = mQueryMinX.begin() + mQueryFirstNarrow;
+	const auto End = mQueryMinX.begin() + mQueryLastNarrow;
+	First = static_cast<int>(std::lower_bound(Begin, End, MinX - mQueryMaxWidth) - mQueryMinX.begin());
+	Last = static_cast<int>(std::upper_bound(Begin, End, MaxX) - mQueryMinX.begin());
+
+	// Narrow slots start at a multiple of 4
+	First = First / QueryLanes * QueryLanes;
+	Last = (Last + QueryLanes - 1) / QueryLanes * QueryLanes;
+}
+
+// Finds the closest hit for every ray, split between the worker threads. Hits must have space for NumRays.
+void CollisionWorld::RaycastBatch(const RayQuery* Rays, const int NumRays, QueryHit* Hits)
+{
+	if (mQueryFrame != mFrame)
+	{
+		PrepareQueries();
+	}
+
+	auto Job = [this, Rays, Hits](const int First, const int Last)
+		{
+			for (int i = First; i < Last; i++)
+			{
+				Raycast(Rays[i], Hits[i]);
+			}
+		};
+	mWorkers.ParallelFor(NumRays, QueryChunkSize, Job);
+}
+
+// Finds the first hit for every shape cast, split between the worker threads. Hits must have space for NumCasts.
+void CollisionWorld::ShapeCastBatch(const ShapeCastQuery* Casts, const int NumCasts, QueryHit* Hits)
+{
+	if (mQueryFrame != mFrame)
+	{
+		PrepareQueries();
+	}
+
+	auto Job = [this, Casts, Hits](const int First, const int Last)
+		{
+			for (int i = First; i < Last; i++)
+			{
+				ShapeCast(Casts[i], Hits[i]);
+			}
+		};
+	mWorkers.ParallelFor(NumCasts, QueryChunkSize, Job);
+}
+
+// Slab test of a box with half size HalfSize moving from Origin along Direction (a ray if HalfSize is 0) against 4 bounding boxes at a time,
+// then TestBody(Body, MaxDistance, Distance, Normal) for each body whose box it goes through before the closest hit so far.
+// Boxes are visited in the order the query moves along X, so the search can stop once the rest start beyond the closest hit.
+// PrepareQueries must have been called since the last step.
+template<typename T>
+void CollisionWorld::SweepQuerySlots(const Vector2& Origin, const Vector2& Direction, const Vector2& HalfSize, const int IgnoreBody,
+	QueryHit& Hit, T& TestBody) const
+{
+	// Keep away from dividing by zero for queries along an axis, keeping the side the query is moving towards
+	const float DirectionX = (fabs(Direction.x) < SweepParallelTolerance) ? copysign(SweepParallelTolerance, Direction.x) : Direction.x;
+	const float DirectionY = (fabs(Direction.y) < SweepParallelTolerance) ? copysign(SweepParallelTolerance, Direction.y) : Direction.y;
+	const bool bMovingRight = Direction.x >= 0.0f;
+
+	const float EndX = Origin.x + Direction.x * Hit.mDistance;
+	int First, Last;
+	GetQueryRange(std::min(Origin.x, EndX) - HalfSize.x, std::max(Origin.x, EndX) + HalfSize.x, First, Last);
+
+	const __m128 OriginX = _mm_set1_ps(Origin.x);
+	const __m128 OriginY = _mm_set1_ps(Origin.y);
+	const __m128 HalfSizeX = _mm_set1_ps(HalfSize.x);
+	const __m128 HalfSizeY = _mm_set1_ps(HalfSize.y);
+	const __m128 InverseX = _mm_set1_ps(1.0f / DirectionX);
+	const __m128 InverseY = _mm_set1_ps(1.0f / DirectionY);
+	const __m128 Zero = _mm_setzero_ps();
+
+	// Wide bodies, then the bodies near the query along X, in the direction it moves
+	const int NumWideBlocks = mQueryNumWideSlots / QueryLanes;
+	const int NumBlocks = NumWideBlocks + (Last - First) / QueryLanes;
+
+	for (int Block = 0; Block < NumBlocks; Block++)
+	{
+		int i;
+		if (Block < NumWideBlocks)
+		{
+			i = Block * QueryLanes;
+		}
+		else
+		{
+			i = bMovingRight ? First + (Block - NumWideBlocks) * QueryLanes : Last - (Block - NumWideBlocks + 1) * QueryLanes;
+
+			// Boxes are sorted by their left, so none of the rest can be reached before the closest hit
+			const float ReachX = Origin.x + Direction.x * Hit.mDistance;
+			if (bMovingRight ? mQueryMinX[i] > ReachX + HalfSize.x : mQueryMinX[i + QueryLanes - 1] + mQueryMaxWidth < ReachX - HalfSize.x)
+			{
+				break;
+			}
+		}
+
+		// Distances along the query to each side of the boxes, grown by the query's half size
+		const __m128 X1 = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(_mm_loadu_ps(&mQueryMinX[i]), HalfSizeX), OriginX), InverseX);
+		const __m128 X2 = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(_mm_loadu_ps(&mQueryMaxX[i]), HalfSizeX), OriginX), InverseX);
+		const __m128 Y1 = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(_mm_loadu_ps(&mQueryMinY[i]), HalfSizeY), OriginY), InverseY);
+		const __m128 Y2 = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(_mm_loadu_ps(&mQueryMaxY[i]), HalfSizeY), OriginY), InverseY);
+
+		const __m128 Near = _mm_max_ps(_mm_min_ps(X1, X2), _mm_min_ps(Y1, Y2));
+		const __m128 Far = _mm_min_ps(_mm_max_ps(X1, X2), _mm_max_ps(Y1, Y2));
+
+		// Query goes through the box before the closest hit so far
+		const __m128 Through = _mm_and_ps(_mm_cmple_ps(Near, Far), _mm_and_ps(_mm_cmpge_ps(Far, Zero), _mm_cmple_ps(Near, _mm_set1_ps(Hit.mDistance))));
+		const int Mask = _mm_movemask_ps(Through);
+		if (Mask == 0)
+		{
+			continue;
+		}
+
+		for (int Lane = 0; Lane < QueryLanes; Lane++)
+		{
+			const int Body = mQueryBodies[i + Lane];
+			if ((Mask & (1 << Lane)) == 0 || Body == -1 || Body == IgnoreBody)
+			{
+				continue;
+			}
+
+			float Distance;
+			Vector2 Normal;
+			if (TestBody(mBodies[Body], Hit.mDistance, Distance, Normal))
+			{
+				Hit.mBody = Body;
+				Hit.mDistance = Distance;
+				Hit.mNormal = Normal;
+			}
+		}
+	}
+}
+
+// Closest body the ray hits.
+void CollisionWorld::Raycast(const RayQuery& Ray, QueryHit& Hit) const
+{
+	InitialiseHit(Hit, Ray.mMaxDistance);
+
+	auto TestBody = [this, &Ray](const CollisionBody& Body, const float MaxDistance, float& Distance, Vector2& Normal)
+		{
+			return RayToBody(Body, Ray.mOrigin, Ray.mDirection, MaxDistance, Distance, Normal);
+		};
+	SweepQuerySlots(Ray.mOrigin, Ray.mDirection, { 0.0f, 0.0f }, Ray.mIgnoreBody, Hit, TestBody);
+}
+
+// First body the cast shape hits. The bounding box of the shape is swept to find the bodies to test.
+void CollisionWorld::ShapeCast(const ShapeCastQuery& Cast, QueryHit& Hit) const
+{
+	InitialiseHit(Hit, Cast.mMaxDistance);
+
+	const BoundingBox Box = Cast.mShape->GetBoundingBox();
+	const Vector2 HalfSize = Box.mMax.Subtract(Box.mMin).MultiplyScalar(0.5f);
+
+	auto TestBody = [this, &Cast](const CollisionBody& Body, const float MaxDistance, float& Distance, Vector2& Normal)
+		{
+			return ShapeCastToBody(Body, *Cast.mShape, Cast.mDirection, MaxDistance, Distance, Normal);
+		};
+	SweepQuerySlots(Box.GetCentre(), Cast.mDirection, HalfSize, Cast.mIgnoreBody, Hit, TestBody);
+}
+
+// Closest body the ray hits, testing every body with OutlineCastToOutline. Slow, but gives the answer Raycast should find
+// without using the same tests. NextDistance is set to the closest hit on any other body.
+void CollisionWorld::RaycastAllBodies(const RayQuery& Ray, QueryHit& Hit, float& NextDistance) const
+{
+	const std::vector<Vector2> RayCorners = { Ray.mOrigin };
+	CastOutlineAllBodies(RayCorners, Ray.mDirection, Ray.mMaxDistance, Ray.mIgnoreBody, Hit, NextDistance);
+}
+
+// First body the cast shape hits, testing every body with OutlineCastToOutline. Slow, but gives the answer ShapeCast should find
+// without using the same tests. NextDistance is set to the closest hit on any other body.
+void CollisionWorld::ShapeCastAllBodies(const ShapeCastQuery& Cast, QueryHit& Hit, float& NextDistance) const
+{
+	CastOutlineAllBodies(Cast.mShape->mVerticesPositions, Cast.mDirection, Cast.mMaxDistance, Cast.mIgnoreBody, Hit, NextDistance);
+}
+
+// Closest and next closest hits of the cast outline moving along Direction, testing every body.
+void CollisionWorld::CastOutlineAllBodies(const std::vector<Vector2>& CastCorners, const Vector2& Direction, const float MaxDistance, const int IgnoreBody,
+	QueryHit& Hit, float& NextDistance) const
+{
+	InitialiseHit(Hit, MaxDistance);
+	NextDistance = MaxDistance;
+
+	// Box around the whole sweep. Bodies outside it can't be hit.
+	BoundingBox SweepBox = { CastCorners[0], CastCorners[0] };
+	for (int i = 0; i < CastCorners.size(); i++)
+	{
+		const Vector2 End = CastCorners[i].Add(Direction.MultiplyScalar(MaxDistance));
+		SweepBox.mMin = { std::min({ SweepBox.mMin.x, CastCorners[i].x, End.x }), std::min({ SweepBox.mMin.y, CastCorners[i].y, End.y }) };
+		SweepBox.mMax = { std::max({ SweepBox.mMax.x, CastCorners[i].x, End.x }), std::max({ SweepBox.mMax.y, CastCorners[i].y, End.y }) };
+	}
+
+	std::vector<Vector2> Corners;
+	for (int i = 0; i < mBodies.size(); i++)
+	{
+		if (i == IgnoreBody || !mBodies.at(i).mBox.Overlaps(SweepBox))
+		{
+			continue;
+		}
+
+		float Radius;
+		float Distance;
+		Vector2 Normal;
+		GetBodyOutline(mBodies.at(i), Corners, Radius);
+		if (!OutlineCastToOutline(CastCorners, Direction, Corners, Radius, MaxDistance, Distance, Normal))
+		{
+			continue;
+		}
+
+		if (Hit.mBody == -1 || Distance < Hit.mDistance)
+		{
+			NextDistance = Hit.mDistance;
+			Hit = { i, Distance, Normal };
+		}
+		else
+		{
+			NextDistance = std::min(NextDistance, Distance);
+		}
+	}
+}
+
+// Outline of the body's shape for OutlineCastToOutline: the corners of a polygon or box, the ends of a capsule
+// or the centre of a circle, and the radius around them.
+void CollisionWorld::GetBodyOutline(const CollisionBody& Body, std::vector<Vector2>& Corners, float& Radius) const
+{
+	Corners.clear();
+	Radius = 0.0f;
+
+	switch (Body.mType)
+	{
+	case eShapeCircle:
+		Corners.push_back(mCircles.at(Body.mShapeIndex).mCentrePosition);
+		Radius = mCircles.at(Body.mShapeIndex).mRadius;
+		break;
+	case eShapePolygon:
+		Corners = mPolygons.at(Body.mShapeIndex).mVerticesPositions;
+		break;
+	case eShapeAABB:
+	{
+		const AABB& Box = mAABBs.at(Body.mShapeIndex);
+		Corners.push_back(Box.mCentrePosition.Subtract(Box.mHalfSize));
+		Corners.push_back({ Box.mCentrePosition.x + Box.mHalfSize.x, Box.mCentrePosition.y - Box.mHalfSize.y });
+		Corners.push_back(Box.mCentrePosition.Add(Box.mHalfSize));
+		Corners.push_back({ Box.mCentrePosition.x - Box.mHalfSize.x, Box.mCentrePosition.y + Box.mHalfSize.y });
+		break;
+	}
+	case eShapeOBB:
+		Corners.resize(SquareNumCorners);
+		mOBBs.at(Body.mShapeIndex).GetCornersPositions(Corners.data());
+		break;
+	case eShapeCapsule:
+		Corners.push_back(mCapsules.at(Body.mShapeIndex).mEndsPositions[0]);
+		Corners.push_back(mCapsules.at(Body.mShapeIndex).mEndsPositions[1]);
+		Radius = mCapsules.at(Body.mShapeIndex).mRadius;
+		break;
+	default:
+		break;
+	}
+}
+
+// Exact ray test against one body. Polygons and boxes clip the ray against each axis (the ray is a point being swept),
+// circles are solved directly, and capsules are their two end circles and the box between them.
+bool CollisionWorld::RayToBody(const CollisionBody& Body, const Vector2& Origin, const Vector2& Direction, const float MaxDistance,
+	float& Distance, Vector2& Normal) const
+{
+	const Vector2 WorldAxes[SquareNumAxesToCheck] = { { 1.0f, 0.0f }, { 0.0f, 1.0f } };
+	const Vector2* Axes = nullptr;
+	int NumAxes = 0;
+
+	switch (Body.mType)
+	{
+	case eShapeCircle:
+		return RayToCircle(Origin, Direction, MaxDistance, mCircles.at(Body.mShapeIndex).mCentrePosition, mCircles.at(Body.mShapeIndex).mRadius, Distance, Normal);
+	case eShapePolygon:
+		Axes = mPolygons.at(Body.mShapeIndex).mAxes.data();
+		NumAxes = static_cast<int>(mPolygons.at(Body.mShapeIndex).mAxes.size());
+		break;
+	case eShapeAABB:
+		Axes = WorldAxes;
+		NumAxes = SquareNumAxesToCheck;
+		break;
+	case eShapeOBB:
+		Axes = mOBBs.at(Body.mShapeIndex).mAxes;
+		NumAxes = SquareNumAxesToCheck;
+		break;
+	case eShapeCapsule:
+	{
+		const Capsule& Cap = mCapsules.at(Body.mShapeIndex);
+		bool bHit = false;
+		float BestDistance = MaxDistance;
+
+		for (int i = 0; i < 2; i++)
+		{
+			if (RayToCircle(Origin, Direction, BestDistance, Cap.mEndsPositions[i], Cap.mRadius, Distance, Normal))
+			{
+				BestDistance = Distance;
+				bHit = true;
+			}
+		}
+
+		// Box between the end circles
+		Vector2 CoreAxes[SquareNumAxesToCheck] = { Cap.mEndsPositions[1].Subtract(Cap.mEndsPositions[0]) };
+		if (Cap.mHalfLength > 0.0f)
+		{
+			CoreAxes[0].Normalise();
+			CoreAxes[1] = CoreAxes[0].PerpendicularVector();
+			const Vector2 CoreHalfSize = { Cap.mHalfLength, Cap.mRadius };
+
+			float Enter = 0.0f;
+			float Exit = BestDistance;
+			Vector2 CoreNormal = { 0.0f, 0.0f };
+			bool bCoreHit = true;
+			for (int i = 0; i < SquareNumAxesToCheck && bCoreHit; i++)
+			{
+				float Min, Max;
+				GetMinMaxOnAxisBox(CoreAxes[i], Cap.mCentrePosition, CoreAxes, CoreHalfSize, Min, Max);
+				const float OriginOnAxis = Origin.DotProduct(CoreAxes[i]);
+				bCoreHit = SweepIntervalOnAxis(CoreAxes[i], OriginOnAxis, OriginOnAxis, Direction.DotProduct(CoreAxes[i]), Min, Max, Enter, Exit, CoreNormal);
+			}
+
+			if (bCoreHit && (!bHit || Enter < BestDistance))
+			{
+				BestDistance = Enter;
+				Normal = (CoreNormal.x == 0.0f && CoreNormal.y == 0.0f) ? Direction.MultiplyScalar(-1.0f) : CoreNormal;
+				bHit = true;
+			}
+		}
+
+		Distance = BestDistance;
+		return bHit;
+	}
+	default:
+		return false;
+	}
+
+	float Enter = 0.0f;
+	float Exit = MaxDistance;
+	Normal = { 0.0f, 0.0f };
+
+	for (int i = 0; i < NumAxes; i++)
+	{
+		float Min, Max;
+		ProjectBody(Body, Axes[i], Min, Max);
+		const float OriginOnAxis = Origin.DotProduct(Axes[i]);
+
+		if (!SweepIntervalOnAxis(Axes[i], OriginOnAxis, OriginOnAxis, Direction.DotProduct(Axes[i]), Min, Max, Enter, Exit, Normal))
+		{
+			return false;
+		}
+	}
+
+	// Ray starts inside
+	if (Normal.x == 0.0f && Normal.y == 0.0f)
+	{
+		Normal = Direction.MultiplyScalar(-1.0f);
+	}
+
+	Distance = Enter;
+	return true;
+}
+
+// Exact cast of the polygon against one body. Polygons and boxes use swept SAT: each axis narrows the distances where
+// the projections overlap, and the shapes hit at the latest distance they start overlapping on every axis.
+// Circles are solved with PolygonCastToCircle, and capsules are their two end circles and the box between them.
+bool CollisionWorld::ShapeCastToBody(const CollisionBody& Body, const Polygon& CastShape, const Vector2& Direction, const float MaxDistance,
+	float& Distance, Vector2& Normal) const
+{
+	const Vector2 WorldAxes[SquareNumAxesToCheck] = { { 1.0f, 0.0f }, { 0.0f, 1.0f } };
+	const Vector2* Axes = nullptr;
+	int NumAxes = 0;
+
+	switch (Body.mType)
+	{
+	case eShapeCircle:
+		return PolygonCastToCircle(CastShape, Direction, MaxDistance, mCircles.at(Body.mShapeIndex).mCentrePosition, mCircles.at(Body.mShapeIndex).mRadius,
+			Distance, Normal);
+	case eShapePolygon:
+		Axes = mPolygons.at(Body.mShapeIndex).mAxes.data();
+		NumAxes = static_cast<int>(mPolygons.at(Body.mShapeIndex).mAxes.size());
+		break;
+	case eShapeAABB:
+		Axes = WorldAxes;
+		NumAxes = SquareNumAxesToCheck;
+		break;
+	case eShapeOBB:
+		Axes = mOBBs.at(Body.mShapeIndex).mAxes;
+		NumAxes = SquareNumAxesToCheck;
+		break;
+	case eShapeCapsule:
+	{
+		const Capsule& Cap = mCapsules.at(Body.mShapeIndex);
+		bool bHit = false;
+		float BestDistance = MaxDistance;
+
+		for (int i = 0; i < 2; i++)
+		{
+			if (PolygonCastToCircle(CastShape, Direction, BestDistance, Cap.mEndsPositions[i], Cap.mRadius, Distance, Normal))
+			{
+				BestDistance = Distance;
+				bHit = true;
+			}
+		}
+
+		// Box between the end circles
+		Vector2 CoreAxes[SquareNumAxesToCheck] = { Cap.mEndsPositions[1].Subtract(Cap.mEndsPositions[0]) };
+		if (Cap.mHalfLength > 0.0f)
+		{
+			CoreAxes[0].Normalise();
+			CoreAxes[1] = CoreAxes[0].PerpendicularVector();
+			const Vector2 CoreHalfSize = { Cap.mHalfLength, Cap.mRadius };
+
+			float Enter = 0.0f;
+			float Exit = BestDistance;
+			Vector2 CoreNormal = { 0.0f, 0.0f };
+			bool bCoreHit = true;
+			float Min1, Max1, Min2, Max2;
+			for (int i = 0; i < CastShape.mAxes.size() && bCoreHit; i++)
+			{
+				GetMinMaxVertexOnAxisShape(CastShape.mAxes[i], CastShape, Min1, Max1);
+				GetMinMaxOnAxisBox(CastShape.mAxes[i], Cap.mCentrePosition, CoreAxes, CoreHalfSize, Min2, Max2);
+				bCoreHit = SweepIntervalOnAxis(CastShape.mAxes[i], Min1, Max1, Direction.DotProduct(CastShape.mAxes[i]), Min2, Max2, Enter, Exit, CoreNormal);
+			}
+			for (int i = 0; i < SquareNumAxesToCheck && bCoreHit; i++)
+			{
+				GetMinMaxVertexOnAxisShape(CoreAxes[i], CastShape, Min1, Max1);
+				GetMinMaxOnAxisBox(CoreAxes[i], Cap.mCentrePosition, CoreAxes, CoreHalfSize, Min2, Max2);
+				bCoreHit = SweepIntervalOnAxis(CoreAxes[i], Min1, Max1, Direction.DotProduct(CoreAxes[i]), Min2, Max2, Enter, Exit, CoreNormal);
+			}
+
+			if (bCoreHit && (!bHit || Enter < BestDistance))
+			{
+				BestDistance = Enter;
+				Normal = (CoreNormal.x == 0.0f && CoreNormal.y == 0.0f) ? Direction.MultiplyScalar(-1.0f) : CoreNormal;
+				bHit = true;
+			}
+		}
+
+		Distance = BestDistance;
+		return bHit;
+	}
+	default:
+		return false;
+	}
+
+	float Enter = 0.0f;
+	float Exit = MaxDistance;
+	Normal = { 0.0f, 0.0f };
+	float Min1, Max1, Min2, Max2;
+
+	// Cast shape's axes
+	for (int i = 0; i < CastShape.mAxes.size(); i++)
+	{
+		GetMinMaxVertexOnAxisShape(CastShape.mAxes[i], CastShape, Min1, Max1);
+		ProjectBody(Body, CastShape.mAxes[i], Min2, Max2);
+
+		if (!SweepIntervalOnAxis(CastShape.mAxes[i], Min1, Max1, Direction.DotProduct(CastShape.mAxes[i]), Min2, Max2, Enter, Exit, Normal))
+		{
+			return false;
+		}
+	}
+
+	// Body's axes
+	for (int i = 0; i < NumAxes; i++)
+	{
+		GetMinMaxVertexOnAxisShape(Axes[i], CastShape, Min1, Max1);
+		ProjectBody(Body, Axes[i], Min2, Max2);
+
+		if (!SweepIntervalOnAxis(Axes[i], Min1, Max1, Direction.DotProduct(Axes[i]), Min2, Max2, Enter, Exit, Normal))
+		{
+			return false;
+		}
+	}
+
+	// Shape starts overlapping the body
+	if (Normal.x == 0.0f && Normal.y == 0.0f)
+	{
+		Normal = Direction.MultiplyScalar(-1.0f);
+	}
+
+	Distance = Enter;
+	return true;
+}
+
+// Sets up the grid for agents in the square from -HalfArea to HalfArea, and reserves space for MaxAgents,
+// so adding agents and stepping the crowd don't allocate. CellSize must be at least the width of the widest agent.
+void CrowdWorld::Initialise(const float HalfArea, const float CellSize, const int MaxAgents)
+{
+	mHalfArea = HalfArea;
+	mCellSize = CellSize;
+	mGridWidth = std::max(1, static_cast<int>(ceil(2.0f * HalfArea / mCellSize)));
+	mCellStarts.assign(mGridWidth * mGridWidth + 1, 0);
+
+	mAgents.reserve(MaxAgents);
+	mPushes.reserve(MaxAgents);
+	mCellAgents.reserve(MaxAgents);
+	mCellBoxes.reserve(MaxAgents);
+	mWorld.mBodies.reserve(MaxAgents);
+	mWorld.mSortedBodies.reserve(MaxAgents);
+	mWorld.mCircles.reserve(MaxAgents);
+	mWorld.mPolygons.reserve(MaxAgents);
+}
+
+// Adds an agent, which starts walking towards a random goal at up to MaxSpeed. The shape must fit in a cell of the grid.
+// Seed picks the agent's goals and must not be 0.
+int CrowdWorld::AddAgent(const Circle& NewShape, const Vector2& Position, const float MaxSpeed, const unsigned int Seed)
+{
+	return AddAgent(mWorld.AddBody(NewShape, Position, 0.0f, false), MaxSpeed, Seed);
+}
+
+int CrowdWorld::AddAgent(const Polygon& NewShape, const Vector2& Position, const float MaxSpeed, const unsigned int Seed)
+{
+	return AddAgent(mWorld.AddBody(NewShape, Position, 0.0f, false), MaxSpeed, Seed);
+}
+
+// Adds the agent for a body already in the world, which must be the last body added.
+int CrowdWorld::AddAgent(const int Body, const float MaxSpeed, const unsigned int Seed)
+{
+	CrowdAgent Agent;
+	Agent.mMaxSpeed = MaxSpeed;
+	Agent.mRandomState = Seed;
+	Agent.mGoal = PickGoal(Agent);
+	Agent.mCell = GetCell(mWorld.mBodies.at(Body).mPosition);
+
+	mAgents.push_back(Agent);
+	mPushes.push_back({ 0.0f, 0.0f });
+	mCellAgents.push_back(Body);
+	mCellBoxes.push_back(mWorld.mBodies.at(Body).mBox);
+	return Body;
+}
+
+// Steers and moves every agent, then finds how far each agent must move out of the others, then moves them.
+// Each stage is split between the world's worker threads, apart from building the grid.
+void CrowdWorld::Step(const float DeltaTime)
+{
+	mStats = {};
+	const int NumAgents = static_cast<int>(mAgents.size());
+
+	auto Steer = [this, DeltaTime](const int First, const int Last)
+		{
+			SteerAgents(First, Last, DeltaTime);
+		};
+	mWorld.mWorkers.ParallelFor(NumAgents, CrowdChunkSize, Steer);
+
+	BuildGrid();
+
+	// Chunks are rows of the grid, so the agents in a chunk are near each other and share neighbours.
+	// Each chunk counts its own statistics, and adds them to the step's once it is done.
+	std::mutex StatsMutex;
+	auto Collide = [this, &StatsMutex](const int First, const int Last)
+		{
+			CrowdStepStats ChunkStats = {};
+			CollideAgents(First, Last, ChunkStats);
+
+			std::lock_guard<std::mutex> Lock(StatsMutex);
+			mStats.mNumPairs += ChunkStats.mNumPairs;
+			mStats.mNumCollisions += ChunkStats.mNumCollisions;
+			for (int i = 0; i < eNumPolygonLevels; i++)
+			{
+				mStats.mNumPolygonTests[i] += ChunkStats.mNumPolygonTests[i];
+			}
+		};
+	mWorld.mWorkers.ParallelFor(mGridWidth, CrowdRowsPerChunk, Collide);
+
+	auto Apply = [this](const int First, const int Last)
+		{
+			ApplyPushes(First, Last);
+		};
+	mWorld.mWorkers.ParallelFor(NumAgents, CrowdChunkSize, Apply);
+}
+
+// Turns each agent's velocity towards its goal, and moves it. Agents facing the way they walk only matters to polygons.
+void CrowdWorld::SteerAgents(const int First, const int Last, const float DeltaTime)
+{
+	const float Blend = std::min(1.0f, CrowdSteerRate * DeltaTime);
+
+	for (int i = First; i < Last; i++)
+	{
+		CollisionBody& Body = mWorld.mBodies[i];
+		CrowdAgent& Agent = mAgents[i];
+
+		Vector2 ToGoal = Agent.mGoal.Subtract(Body.mPosition);
+		if (ToGoal.DotProduct(ToGoal) < CrowdGoalRadius * CrowdGoalRadius)
+		{
+			Agent.mGoal = PickGoal(Agent);
+			ToGoal = Agent.mGoal.Subtract(Body.mPosition);
+		}
+
+		const float Distance = ToGoal.Length();
+		if (Distance > 0.0f)
+		{
+			const Vector2 Wanted = ToGoal.MultiplyScalar(Agent.mMaxSpeed / Distance);
+			Body.mVelocity = Body.mVelocity.Add(Wanted.Subtract(Body.mVelocity).MultiplyScalar(Blend));
+		}
+		Body.mPosition = Body.mPosition.Add(Body.mVelocity.MultiplyScalar(DeltaTime));
+
+		// Corners of regular polygons start at +Y, so the first corner points along the velocity
+		if (Body.mType == eShapePolygon)
+		{
+			Body.mRotation = atan2(-Body.mVelocity.x, Body.mVelocity.y) / DegreesToRadians;
+		}
+
+		mWorld.UpdateBody(Body);
+		Agent.mCell = GetCell(Body.mPosition);
+	}
+}
+
+// Sorts the agents into their cells with a counting sort. Agents stay in order of index within a cell.
+void CrowdWorld::BuildGrid()
+{
+	const int NumCells = mGridWidth * mGridWidth;
+	std::fill(mCellStarts.begin(), mCellStarts.end(), 0);
+
+	for (int i = 0; i < mAgents.size(); i++)
+	{
+		mCellStarts[mAgents[i].mCell]++;
+	}
+
+	// End of each cell, then filling each cell from the back leaves the start of each cell
+	for (int i = 1; i < NumCells; i++)
+	{
+		mCellStarts[i] += mCellStarts[i - 1];
+	}
+	mCellStarts[NumCells] = static_cast<int>(mAgents.size());
+
+	for (int i = static_cast<int>(mAgents.size()) - 1; i >= 0; i--)
+	{
+		const int Slot = --mCellStarts[mAgents[i].mCell];
+		mCellAgents[Slot] = i;
+		mCellBoxes[Slot] = mWorld.mBodies[i].mBox;
+	}
+}
+
+// Tests the agents in the rows of the grid against every agent in their own and the 8 cells around them, and adds up how far
+// each must move. Both agents in a pair find the collision, so each moves half of the way out.
+void CrowdWorld::CollideAgents(const int FirstRow, const int LastRow, CrowdStepStats& Stats)
+{
+	for (int Row = FirstRow; Row < LastRow; Row++)
+	{
+		const int FirstNearRow = std::max(Row - 1, 0);
+		const int LastNearRow = std::min(Row + 1, mGridWidth - 1);
+
+		for (int Column = 0; Column < mGridWidth; Column++)
+		{
+			const int Cell = Row * mGridWidth + Column;
+			const int FirstNearColumn = std::max(Column - 1, 0);
+			const int LastNearColumn = std::min(Column + 1, mGridWidth - 1);
+
+			for (int Slot = mCellStarts[Cell]; Slot < mCellStarts[Cell + 1]; Slot++)
+			{
+				const int Agent = mCellAgents[Slot];
+				const BoundingBox& Box = mCellBoxes[Slot];
+				Vector2 Push = { 0.0f, 0.0f };
+
+				for (int NearRow = FirstNearRow; NearRow <= LastNearRow; NearRow++)
+				{
+					// Cells next to each other in a row have their agents next to each other in the slots
+					const int RowEnd = mCellStarts[NearRow * mGridWidth + LastNearColumn + 1];
+					for (int Other = mCellStarts[NearRow * mGridWidth + FirstNearColumn]; Other < RowEnd; Other++)
+					{
+						if (Other == Slot || !Box.Overlaps(mCellBoxes[Other]))
+						{
+							continue;
+						}
+						Stats.mNumPairs++;
+
+						CollisionData Data;
+						Data.InitialiseData();
+						const bool bColliding = mWorld.CollideBodies(Agent, mCellAgents[Other], Data);
+
+						if (Data.mPolygonLevel != eLevelNone)
+						{
+							Stats.mNumPolygonTests[Data.mPolygonLevel]++;
+						}
+
+						if (bColliding)
+						{
+							Stats.mNumCollisions++;
+							Push = Push.Add(Data.mNormal.MultiplyScalar(0.5f * Data.mPenetration));
+						}
+					}
+				}
+
+				mPushes[Agent] = Push;
+			}
+		}
+	}
+}
+
+// Moves each agent out of the others, stops it walking into them, and keeps it in the area.
+void CrowdWorld::ApplyPushes(const int First, const int Last)
+{
+	for (int i = First; i < Last; i++)
+	{
+		CollisionBody& Body = mWorld.mBodies[i];
+		const Vector2 OldPosition = Body.mPosition;
+		Vector2 Push = mPushes[i];
+
+		if (Push.x != 0.0f || Push.y != 0.0f)
+		{
+			Body.mPosition = Body.mPosition.Add(Push);
+
+			// Slide past the agents in the way instead of bouncing off them
+			Push.Normalise();
+			const float SpeedIntoPush = Body.mVelocity.DotProduct(Push);
+			if (SpeedIntoPush < 0.0f)
+			{
+				Body.mVelocity = Body.mVelocity.Subtract(Push.MultiplyScalar(SpeedIntoPush));
+			}
+		}
+
+		Body.mPosition.x = std::clamp(Body.mPosition.x, -mHalfArea, mHalfArea);
+		Body.mPosition.y = std::clamp(Body.mPosition.y, -mHalfArea, mHalfArea);
+
+		if (Body.mPosition.x != OldPosition.x || Body.mPosition.y != OldPosition.y)
+		{
+			mWorld.UpdateBody(Body);
+		}
+	}
+}
+
+// Cell the position is in. Positions outside the area are in the closest cell on the edge.
+int CrowdWorld::GetCell(const Vector2& Position) const
+{
+	const int CellX = std::clamp(static_cast<int>((Position.x + mHalfArea) / mCellSize), 0, mGridWidth - 1);
+	const int CellY = std::clamp(static_cast<int>((Position.y + mHalfArea) / mCellSize), 0, mGridWidth - 1);
+	return CellY * mGridWidth + CellX;
+}
+
+// Random point in the area, from the agent's own xorshift generator.
+Vector2 CrowdWorld::PickGoal(CrowdAgent& Agent) const
+{
+	float Coordinates[2];
+
+	for (int i = 0; i < 2; i++)
+	{
+		Agent.mRandomState ^= Agent.mRandomState << 13;
+		Agent.mRandomState ^= Agent.mRandomState >> 17;
+		Agent.mRandomState ^= Agent.mRandomState << 5;
+		Coordinates[i] = (Agent.mRandomState / 4294967296.0f * 2.0f - 1.0f) * mHalfArea;
+	}
+
+	return { Coordinates[0], Coordinates[1] };
+}
+
+// Runs a crowd of agents without the engine. This is the reference load for optimising the collision world.
+// The same crowd is timed with 1 thread, then twice as many each time up to the number of hardware threads,
+// reporting steps per second and the speed up over 1 thread. Returns false if the timed steps made any allocations.
+bool RunCrowdWorld()
+{
+	CrowdWorld Crowd;
+	Crowd.Initialise(CrowdHalfArea, CrowdCellSize, CrowdNumAgents);
+
+	std::mt19937 Random(1);
+	std::uniform_real_distribution<float> Position(-CrowdHalfArea, CrowdHalfArea);
+	std::uniform_real_distribution<float> Radius(CrowdMinAgentRadius, CrowdMaxAgentRadius);
+	std::uniform_real_distribution<float> Speed(0.5f * MoveSpeed, MoveSpeed);
+
+	// Half circles, half regular polygons with 3 to 8 sides
+	for (int i = 0; i < CrowdNumAgents; i++)
+	{
+		const Vector2 StartPosition = { Position(Random), Position(Random) };
+
+		if (i % 2 == 0)
+		{
+			Circle NewCircle;
+			NewCircle.InitialiseCircle(nullptr, Radius(Random));
+			Crowd.AddAgent(NewCircle, StartPosition, Speed(Random), i + 1);
+		}
+		else
+		{
+			Polygon NewPolygon;
+			NewPolygon.InitialiseShape(nullptr, nullptr, 3 + (i / 2) % 6, Radius(Random));
+			Crowd.AddAgent(NewPolygon, StartPosition, Speed(Random), i + 1);
+		}
+	}
+
+	// Let agents that started overlapping move apart
+	for (int i = 0; i < CrowdNumWarmUpSteps; i++)
+	{
+		Crowd.Step(CrowdDeltaTime);
+	}
+
+	std::cout << "Crowd: " << CrowdNumAgents << " agents, " << CrowdNumTimedSteps << " steps for each number of threads" << std::endl;
+
+	const int MaxThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	double OneThreadStepTime = 0.0;
+	long long NumAllocations = 0;
+	long long NumCollisions = 0;
+	long long NumPairs = 0;
+	long long NumPolygonTests[eNumPolygonLevels] = {};
+	long long NumTimedSteps = 0;
+
+	for (int NumThreads = 1; ; NumThreads = std::min(NumThreads * 2, MaxThreads))
+	{
+		// Starting the threads allocates, so is outside the counted steps
+		Crowd.mWorld.InitialiseWorkers(NumThreads);
+		const long long AllocationsAtStart = NumHeapAllocations;
+		const auto StartTime = std::chrono::steady_clock::now();
+
+		for (int i = 0; i < CrowdNumTimedSteps; i++)
+		{
+			Crowd.Step(CrowdDeltaTime);
+			NumCollisions += Crowd.mStats.mNumCollisions;
+			NumPairs += Crowd.mStats.mNumPairs;
+			for (int Level = 0; Level < eNumPolygonLevels; Level++)
+			{
+				NumPolygonTests[Level] += Crowd.mStats.mNumPolygonTests[Level];
+			}
+			NumTimedSteps++;
+		}
+
+		const std::chrono::duration<double, std::milli> Time = std::chrono::steady_clock::now() - StartTime;
+		NumAllocations += NumHeapAllocations - AllocationsAtStart;
+		const double StepTime = Time.count() / CrowdNumTimedSteps;
+		if (NumThreads == 1)
+		{
+			OneThreadStepTime = StepTime;
+		}
+
+		std::cout << NumThreads << " threads: " << StepTime << " ms per step, " << 1000.0 / StepTime << " steps/sec, "
+			<< OneThreadStepTime / StepTime << "x speed up (" << 100.0 * OneThreadStepTime / (StepTime * NumThreads) << "% of ideal)" << std::endl;
+
+		if (NumThreads == MaxThreads)
+		{
+			break;
+		}
+	}
+
+	// Both agents in a pair find it, so halve the counts
+	std::cout << "Average pairs per step: " << NumPairs / 2 / NumTimedSteps << ", collisions: " << NumCollisions / 2 / NumTimedSteps << std::endl;
+	PrintPolygonTests(NumPolygonTests, NumTimedSteps);
+	std::cout << "Allocations after warm up: " << NumAllocations << (NumAllocations == 0 ? "" : " - FAILED, should be 0") << std::endl;
+
+	return NumAllocations == 0;
+}